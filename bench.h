@@ -0,0 +1,139 @@
+/*
+ * Frame time statistics of the benchmark mode (main --bench out.json).
+ *
+ * The gpu time of every dispatch is measured with timer.h, so the render loop only waits for a
+ * result once TIMER_QUERY_COUNT dispatches are in flight. The cpu frame time is the time between
+ * two draw() calls. Once config.frame_count frames are drawn, min, median, p95, p99 and mean of
+ * both are written as json, together with the primary rays per second at the median gpu time.
+ *
+ * NOTE: expects the gl functions (glew) to be declared.
+ */
+#include <stdlib.h> // for qsort
+#include <time.h>   // for timespec_get
+#include <math.h>   // for ceil
+
+#define BENCH_WARMUP_FRAMES  2 // not part of the statistics, the first frames include shader and driver warmup
+
+typedef struct bench_samples_t
+{
+    float* values; /* in ms */
+    uint   count;
+    uint   capacity;
+} bench_samples_t;
+
+typedef struct bench_t
+{
+    int             active;
+    const char*     path;     /* json output, "-" writes to stdout */
+    int             frame;    /* number of frames drawn */
+    double          last_frame_time; /* in seconds, start of the previous draw() */
+
+    gpu_timer_t     timer;    /* of the dispatches, tagged with the frame */
+
+    bench_samples_t gpu_ms;
+    bench_samples_t frame_ms;
+} bench_t;
+
+static double bench_time(void)
+{
+    struct timespec time;
+    timespec_get(&time, TIME_UTC);
+    return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+static void bench_push(bench_samples_t* samples, float value)
+{
+    if (samples->count == samples->capacity)
+    {
+        samples->capacity = samples->capacity ? 2 * samples->capacity : 256;
+        samples->values   = realloc(samples->values, samples->capacity * sizeof(float));
+    }
+    samples->values[samples->count++] = value;
+}
+
+static int bench_compare(const void* lhs, const void* rhs)
+{
+    float a = *(const float*) lhs, b = *(const float*) rhs;
+    return (a > b) - (a < b);
+}
+
+/* writes "name": {min, median, p95, p99, mean} using the nearest-rank percentiles */
+static void bench_write_stats(FILE* file, const char* name, bench_samples_t* samples, int last)
+{
+    fprintf(file, "  \"%s\": ", name);
+    if (samples->count == 0) { fprintf(file, "null%s\n", last ? "" : ","); return; }
+
+    qsort(samples->values, samples->count, sizeof(float), bench_compare);
+    double sum = 0;
+    for (uint i = 0; i < samples->count; i++) { sum += samples->values[i]; }
+
+    #define BENCH_PERCENTILE(p) samples->values[(uint) ceil((p) * samples->count) - 1]
+    fprintf(file, "{ \"min\": %.4f, \"median\": %.4f, \"p95\": %.4f, \"p99\": %.4f, \"mean\": %.4f }%s\n",
+            samples->values[0], BENCH_PERCENTILE(0.5), BENCH_PERCENTILE(0.95), BENCH_PERCENTILE(0.99),
+            sum / samples->count, last ? "" : ",");
+    #undef BENCH_PERCENTILE
+}
+
+static void bench_start(bench_t* bench, const char* path)
+{
+    memset(bench, 0, sizeof(bench_t));
+    bench->active = 1;
+    bench->path   = path;
+    gpu_timer_start(&bench->timer);
+}
+
+/* reads back the oldest query, wait blocks until the gpu is done with its dispatch */
+static int bench_retire(bench_t* bench, int wait)
+{
+    double ms, frame;
+    if (!gpu_timer_retire(&bench->timer, wait, &ms, &frame)) { return 0; }
+    if (frame >= BENCH_WARMUP_FRAMES) { bench_push(&bench->gpu_ms, ms); }
+    return 1;
+}
+
+/* call at the start of draw(), before the dispatch */
+static void bench_begin(bench_t* bench)
+{
+    double time = bench_time();
+    if (bench->frame > BENCH_WARMUP_FRAMES) { bench_push(&bench->frame_ms, 1000.0 * (time - bench->last_frame_time)); }
+    bench->last_frame_time = time;
+
+    /* NOTE: every dispatch is measured, waits for the oldest one if all queries are in flight */
+    while (bench_retire(bench, 0)) {}
+    if (bench->timer.count == TIMER_QUERY_COUNT) { bench_retire(bench, 1); }
+    gpu_timer_begin(&bench->timer, bench->frame);
+}
+
+/* call right after the dispatch, writes the results once frame_count frames are done, width and height are the size of the image */
+static void bench_end(bench_t* bench, int frame_count, uint width, uint height)
+{
+    gpu_timer_end(&bench->timer);
+    bench->frame++;
+    if (bench->frame != frame_count) { return; }
+
+    /* NOTE: the last frame has no frame time, it would end with the next draw() */
+    while (bench_retire(bench, 1)) {}
+
+    FILE* file = (strcmp(bench->path, "-") == 0) ? stdout : fopen(bench->path, "w");
+    if (!file) { printf("Could not open %s for the benchmark results\n", bench->path); }
+    else
+    {
+        fprintf(file, "{\n");
+        fprintf(file, "  \"width\": %u,\n  \"height\": %u,\n", width, height);
+        fprintf(file, "  \"frames\": %d,\n  \"warmup_frames\": %d,\n", bench->frame, BENCH_WARMUP_FRAMES);
+        bench_write_stats(file, "gpu_ms", &bench->gpu_ms, 0);
+        bench_write_stats(file, "frame_ms", &bench->frame_ms, 0);
+
+        /* NOTE: one primary ray per pixel at the median gpu time (gpu_ms is sorted by now), shadow rays are not counted */
+        double median_ms = bench->gpu_ms.count ? bench->gpu_ms.values[(bench->gpu_ms.count + 1) / 2 - 1] : 0;
+        if (median_ms > 0) { fprintf(file, "  \"primary_mrays_per_s\": %.3f\n", width * height / (median_ms * 1e3)); }
+        else               { fprintf(file, "  \"primary_mrays_per_s\": null\n"); }
+        fprintf(file, "}\n");
+        if (file != stdout) { fclose(file); printf("Wrote benchmark results to %s\n", bench->path); }
+    }
+
+    gpu_timer_stop(&bench->timer);
+    free(bench->gpu_ms.values);
+    free(bench->frame_ms.values);
+    bench->active = 0;
+}
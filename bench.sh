@@ -0,0 +1,30 @@
+#!/bin/bash
+# triangle-count scaling benchmark of the bvh against testing every primitive per ray
+#
+# Builds standalone executables with a tessellated sphere of BENCH_TRIANGLE_COUNT triangles added
+# to the scene from on_load() and prints the time of a few frames on Mesa llvmpipe. A count of 0
+# is the plain scene (20 primitives). The bvh runs are repeated with the triangle kernel on the
+# vertices of the faces (TRIANGLE_PRECOMPUTED 0) to compare it against the precomputed triangles,
+# and with the megakernel (WAVEFRONT_ENABLE 0) to compare it against the wavefront passes.
+#
+# NOTE: runs headless, so no display is needed, and prints the frame time statistics as json (see bench.h)
+# NOTE: the brute-force variant is O(prims) per ray, so it is only run for the smaller scenes.
+
+bvh_counts="0 10000 100000 1000000"
+brute_force_counts="0 10000"
+
+run() # <triangle count> <bvh enable> [<triangle precomputed> [<wavefront enable>]]
+{
+    precomputed=${3:-1}
+    wavefront=${4:-1}
+    cc -O2 -DCOMPILE_EXE -DCOMPILE_DLL -DBENCH_TRIANGLE_COUNT=$1 -DBVH_ENABLE=$2 -DTRIANGLE_PRECOMPUTED=$precomputed -DWAVEFRONT_ENABLE=$wavefront -Wall -Wshadow -pthread main.c -o bench_main -lglfw -lGLEW -lGL -lEGL -lm || exit 1
+    echo "=== +$1 triangles, bvh: $2, precomputed triangles: $precomputed, wavefront: $wavefront"
+    LIBGL_ALWAYS_SOFTWARE=1 GALLIUM_DRIVER=llvmpipe MESA_GLSL_VERSION_OVERRIDE=430 MESA_GL_VERSION_OVERRIDE=4.3FC ./bench_main --headless --bench -
+}
+
+for count in $bvh_counts;         do run $count 1; done
+for count in $bvh_counts;         do run $count 1 0; done
+for count in $bvh_counts;         do run $count 1 1 0; done
+for count in $brute_force_counts; do run $count 0; done
+
+rm -f bench_main
@@ -0,0 +1,108 @@
+/*
+ * Program binaries on disk (main --shader-cache dir).
+ *
+ * poll_programs() in main.c stores every program it compiles with glGetProgramBinary into a
+ * file of its own in the cache directory and request_program() loads it with glProgramBinary
+ * before it compiles anything, so a cold start or a hot reload only reads the files. The files are named by the
+ * hash of the program (source and defines) and the driver (vendor, renderer and version
+ * strings), a driver update therefore misses the cache instead of loading binaries it cannot
+ * use. A binary the driver still rejects is compiled from source and written over.
+ *
+ * NOTE: expects the gl functions (glew) to be declared.
+ */
+#include <stdint.h> // for uint32_t, uint64_t
+#include <stdlib.h> // for malloc, free
+
+#if defined(_WIN32)
+#include <direct.h> // for _mkdir
+#define binary_cache_mkdir(path) _mkdir(path)
+#else
+#include <sys/stat.h> // for mkdir
+#define binary_cache_mkdir(path) mkdir(path, 0755)
+#endif
+
+#define BINARY_CACHE_MAGIC  0x42505352u // "RSPB"
+#define BINARY_CACHE_MAX    (64u << 20) // bytes of a binary, larger files are treated as corrupt
+
+typedef struct binary_header_t
+{
+    uint32_t magic;
+    uint32_t format; /* of glGetProgramBinary */
+    uint32_t length; /* of the binary that follows the header */
+    uint32_t reserved;
+    uint64_t hash;   /* of the program and the driver, also in the file name */
+} binary_header_t;
+
+/* returns 1 if the driver can save and load program binaries at all */
+static int binary_cache_supported(void)
+{
+    int formats = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+    return formats > 0;
+}
+
+static void binary_cache_file(char* path, size_t size, const char* dir, uint64_t hash)
+{
+    snprintf(path, size, "%s/%016llx.bin", dir, (unsigned long long) hash);
+}
+
+/* returns the program of the binary cached for hash, or 0 if there is none or the driver rejects it */
+static unsigned int binary_cache_load(const char* dir, uint64_t hash)
+{
+    char path[1024];
+    binary_cache_file(path, sizeof(path), dir, hash);
+    FILE* file = fopen(path, "rb");
+    if (!file) { return 0; }
+
+    binary_header_t header;
+    void*           binary = NULL;
+    int             valid  = fread(&header, sizeof(header), 1, file) == 1 && header.magic == BINARY_CACHE_MAGIC &&
+                             header.hash == hash && header.length > 0 && header.length <= BINARY_CACHE_MAX;
+    if (valid)
+    {
+        binary = malloc(header.length);
+        valid  = binary && fread(binary, header.length, 1, file) == 1;
+    }
+    fclose(file);
+
+    unsigned int program_id = 0;
+    if (valid)
+    {
+        program_id = glCreateProgram();
+        glProgramBinary(program_id, header.format, binary, header.length);
+
+        int success = 0;
+        glGetProgramiv(program_id, GL_LINK_STATUS, &success);
+        if (!success) { glDeleteProgram(program_id); program_id = 0; }
+    }
+    free(binary);
+    return program_id;
+}
+
+/* writes the binary of the program to the cache, failures only cost the compile next time */
+static void binary_cache_store(const char* dir, uint64_t hash, unsigned int program_id)
+{
+    int length = 0;
+    glGetProgramiv(program_id, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0 || (uint32_t) length > BINARY_CACHE_MAX) { return; }
+
+    binary_header_t header = { BINARY_CACHE_MAGIC, 0, 0, 0, hash };
+    void*           binary = malloc(length);
+    if (!binary) { return; }
+    GLenum format = 0;
+    glGetProgramBinary(program_id, length, &length, &format, binary);
+    header.format = format;
+    header.length = length;
+
+    char path[1024];
+    binary_cache_mkdir(dir); /* NOTE: fails harmlessly if it exists */
+    binary_cache_file(path, sizeof(path), dir, hash);
+    FILE* file = fopen(path, "wb");
+    if (file)
+    {
+        /* NOTE: a partly written file fails the length check in binary_cache_load() */
+        if (fwrite(&header, sizeof(header), 1, file) != 1 || fwrite(binary, length, 1, file) != 1) { printf("Could not write %s\n", path); }
+        fclose(file);
+    }
+    free(binary);
+}
@@ -1,11 +1,14 @@
 echo >/dev/null # >nul & GOTO WINDOWS & rem ^
 
 # compile as (hot-reloadable) dll + exe
-cc --shared -fPIC -DCOMPILE_DLL -Wall -Wshadow main.c -o code.dll -lGLEW -lGL
-cc -DCOMPILE_EXE -Wall -Wshadow main.c -o main -lglfw -lGL -ldl -lm
+cc --shared -fPIC -DCOMPILE_DLL -Wall -Wshadow -pthread main.c -o code.dll -lGLEW -lGL
+cc -DCOMPILE_EXE -Wall -Wshadow main.c -o main -lglfw -lGL -lEGL -ldl -lm -pthread
+
+# compile the cpu reference renderer (no gpu needed), see cpu.c
+cc -O2 -march=native -ffp-contract=off -Wall -Wshadow -pthread cpu.c -o cpu -lm
 
 # compile as standalone executable
-#cc -DCOMPILE_EXE -DCOMPILE_DLL -Wall -Wshadow main.c -o main -lglfw -lGLEW -lGL -lm
+#cc -DCOMPILE_EXE -DCOMPILE_DLL -Wall -Wshadow -pthread main.c -o main -lglfw -lGLEW -lGL -lEGL -lm
 
 exit 0
 :WINDOWS
@@ -0,0 +1,199 @@
+/*
+ * Bounding volume hierarchy built on the CPU with the surface area heuristic (SAH).
+ *
+ * The builder only sees one aabb_t per primitive and returns a permutation of the primitive
+ * indices, so it does not care what kind of primitive it is working on. The caller is
+ * expected to reorder its primitive buffer according to that permutation, which lets every
+ * leaf reference a contiguous range [left_first, left_first + count).
+ *
+ * Nodes are stored flattened in a single array (bvh_node_t, see common.h) so they can be
+ * uploaded as-is into a shader storage buffer. The root is always at index 0 and the two
+ * children of an interior node are always stored next to each other.
+ *
+ * NOTE: uses binned SAH (BVH_BIN_COUNT bins per axis), which is O(n log n) and good enough
+ * for building scenes with millions of triangles on load.
+ */
+#include <float.h>  // for FLT_MAX
+#include <stdlib.h> // for malloc, free
+
+#define BVH_BIN_COUNT        16
+#define BVH_MAX_LEAF_SIZE     8 // leaves are only allowed to get bigger when we run out of depth
+#define BVH_MAX_DEPTH        (BVH_STACK_SIZE - 3) // see common.h, keeps the shader stack (which starts with all roots) from overflowing
+#define BVH_TRAVERSAL_COST  1.0f // cost of visiting a node relative to a primitive intersection
+
+typedef struct aabb_t { vec3 min; vec3 max; } aabb_t;
+
+static aabb_t aabb_empty(void)
+{
+    aabb_t box = {{{{ FLT_MAX,  FLT_MAX,  FLT_MAX}}}, {{{-FLT_MAX, -FLT_MAX, -FLT_MAX}}}};
+    return box;
+}
+
+static void aabb_grow(aabb_t* box, vec3 p)
+{
+    for (int a = 0; a < 3; a++)
+    {
+        if (p.e[a] < box->min.e[a]) { box->min.e[a] = p.e[a]; }
+        if (p.e[a] > box->max.e[a]) { box->max.e[a] = p.e[a]; }
+    }
+}
+
+static void aabb_merge(aabb_t* box, const aabb_t* other)
+{
+    aabb_grow(box, other->min);
+    aabb_grow(box, other->max);
+}
+
+/* NOTE: returns half the surface area, the factor cancels out in the SAH anyway */
+static float aabb_area(const aabb_t* box)
+{
+    float dx = box->max.x - box->min.x;
+    float dy = box->max.y - box->min.y;
+    float dz = box->max.z - box->min.z;
+    if (dx < 0 || dy < 0 || dz < 0) { return 0.0f; } /* empty box */
+    return dx * dy + dy * dz + dz * dx;
+}
+
+typedef struct bvh_builder_t
+{
+    const aabb_t* bounds;    /* one per primitive, indexed by primitive id   */
+    vec3*         centroids; /* one per primitive, indexed by primitive id   */
+    uint*         indices;   /* permutation of primitive ids that gets built */
+    bvh_node_t*   nodes;
+    uint          node_count;
+    uint          node_base; /* added to child indices, see bvh_build() */
+} bvh_builder_t;
+
+typedef struct bvh_bin_t { aabb_t bounds; uint count; } bvh_bin_t;
+
+static void bvh_subdivide(bvh_builder_t* b, uint node_idx, uint first, uint count, uint depth)
+{
+    bvh_node_t* node = &b->nodes[node_idx];
+
+    /* compute bounds of the node and of the centroids it contains */
+    aabb_t node_bounds     = aabb_empty();
+    aabb_t centroid_bounds = aabb_empty();
+    for (uint i = first; i < first + count; i++)
+    {
+        aabb_merge(&node_bounds, &b->bounds[b->indices[i]]);
+        aabb_grow(&centroid_bounds, b->centroids[b->indices[i]]);
+    }
+    node->min        = node_bounds.min;
+    node->max        = node_bounds.max;
+    node->left_first = first;
+    node->count      = count;
+
+    if (count <= 1 || depth >= BVH_MAX_DEPTH) { return; } /* leaf */
+
+    /* find the cheapest split plane over all axes using binned SAH */
+    int   best_axis = -1;
+    int   best_bin  = 0;
+    float best_cost = FLT_MAX;
+    for (int axis = 0; axis < 3; axis++)
+    {
+        float lo     = centroid_bounds.min.e[axis];
+        float extent = centroid_bounds.max.e[axis] - lo;
+        if (extent <= 0.0f) { continue; } /* all centroids on a plane */
+
+        bvh_bin_t bins[BVH_BIN_COUNT];
+        for (int n = 0; n < BVH_BIN_COUNT; n++) { bins[n].bounds = aabb_empty(); bins[n].count = 0; }
+
+        float scale = BVH_BIN_COUNT / extent;
+        for (uint i = first; i < first + count; i++)
+        {
+            uint prim = b->indices[i];
+            int  n    = (int) ((b->centroids[prim].e[axis] - lo) * scale);
+            if (n > BVH_BIN_COUNT - 1) { n = BVH_BIN_COUNT - 1; }
+            bins[n].count++;
+            aabb_merge(&bins[n].bounds, &b->bounds[prim]);
+        }
+
+        /* sweep from both sides to get the cost of every plane between two bins */
+        float left_area[BVH_BIN_COUNT - 1];
+        uint  left_count[BVH_BIN_COUNT - 1];
+        aabb_t box = aabb_empty();
+        uint   sum = 0;
+        for (int n = 0; n < BVH_BIN_COUNT - 1; n++)
+        {
+            aabb_merge(&box, &bins[n].bounds);
+            sum          += bins[n].count;
+            left_area[n]  = aabb_area(&box);
+            left_count[n] = sum;
+        }
+
+        box = aabb_empty();
+        sum = 0;
+        for (int n = BVH_BIN_COUNT - 1; n > 0; n--)
+        {
+            aabb_merge(&box, &bins[n].bounds);
+            sum += bins[n].count;
+
+            float cost = left_area[n - 1] * left_count[n - 1] + aabb_area(&box) * sum;
+            if (left_count[n - 1] > 0 && sum > 0 && cost < best_cost)
+            {
+                best_cost = cost;
+                best_axis = axis;
+                best_bin  = n;
+            }
+        }
+    }
+
+    /* compare against not splitting at all */
+    float parent_area = aabb_area(&node_bounds);
+    float leaf_cost   = (float) count;
+    float split_cost  = (parent_area > 0.0f) ? BVH_TRAVERSAL_COST + best_cost / parent_area : FLT_MAX;
+    if (split_cost >= leaf_cost && count <= BVH_MAX_LEAF_SIZE) { return; } /* leaf */
+
+    /* partition primitives in place */
+    uint mid = first;
+    if (best_axis != -1)
+    {
+        float lo    = centroid_bounds.min.e[best_axis];
+        float scale = BVH_BIN_COUNT / (centroid_bounds.max.e[best_axis] - lo);
+        uint  last  = first + count;
+        while (mid < last)
+        {
+            int n = (int) ((b->centroids[b->indices[mid]].e[best_axis] - lo) * scale);
+            if (n > BVH_BIN_COUNT - 1) { n = BVH_BIN_COUNT - 1; }
+            if (n < best_bin) { mid++; }
+            else { uint tmp = b->indices[mid]; b->indices[mid] = b->indices[--last]; b->indices[last] = tmp; }
+        }
+    }
+
+    /* NOTE: no usable split plane (e.g. all centroids coincide), split down the middle */
+    if (mid == first || mid == first + count) { mid = first + count / 2; }
+
+    uint left = b->node_count;
+    b->node_count += 2;
+
+    node->left_first = b->node_base + left;
+    node->count      = 0; /* interior node */
+
+    bvh_subdivide(b, left,     first, mid - first,           depth + 1);
+    bvh_subdivide(b, left + 1, mid,   first + count - mid,   depth + 1);
+}
+
+/*
+ * Builds a bvh over count primitive bounds into nodes, which needs room for 2 * count - 1
+ * nodes (at least one). indices receives the order in which the primitives have to be
+ * stored for the leaves to be contiguous. Returns the number of nodes used.
+ *
+ * Child indices are stored relative to node_base, which is where nodes is going to end up
+ * when several trees are packed into one buffer.
+ */
+static uint bvh_build(bvh_node_t* nodes, uint* indices, const aabb_t* bounds, uint count, uint node_base)
+{
+    bvh_builder_t b = { bounds, malloc(sizeof(vec3) * (count ? count : 1)), indices, nodes, 1, node_base };
+
+    for (uint i = 0; i < count; i++)
+    {
+        indices[i] = i;
+        for (int a = 0; a < 3; a++) { b.centroids[i].e[a] = 0.5f * (bounds[i].min.e[a] + bounds[i].max.e[a]); }
+    }
+
+    /* NOTE: an empty scene ends up with a single node with inverted bounds that no ray can hit */
+    bvh_subdivide(&b, 0, 0, count, 0);
+
+    free(b.centroids);
+    return b.node_count;
+}
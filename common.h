@@ -6,22 +6,71 @@
  * NOTE: Can also contain e.g. helper functions that are shared between shaders.
  */
 #define WINDOW_TITLE    "compute raytracer"
-#define WINDOW_WIDTH    960
+#define WINDOW_WIDTH    960 // default size of the window and the images, see main --size
 #define WINDOW_HEIGHT   540
 #define CAMERA_FOV       90
-#define PRIMITIVE_COUNT  30 // size of prim_buf
-#define LIGHT_COUNT       3 // size of light_buf
 
 /* NOTE: for values >=64 we get error: product of local_sizes exceeds MAX_COMPUTE_WORK_GROUP_INVOCATIONS (2048) */
-#define WORK_GROUP_SIZE_X 16 // used in glDispatchCompute and local_size_x in compute shader
-#define WORK_GROUP_SIZE_Y 16 // used in glDispatchCompute and local_size_y in compute shader
+#ifndef WORK_GROUP_SIZE_X
+#define WORK_GROUP_SIZE_X 16 // local_size_x of the passes over pixels, also the size of a tile (adaptive sampling and time slices)
+#endif
+#ifndef WORK_GROUP_SIZE_Y
+#define WORK_GROUP_SIZE_Y 16 // local_size_y of the passes over pixels
+#endif
 
-/* used for lack of enums in glsl */
-#define PRIMITIVE_TYPE_NONE      0
-#define PRIMITIVE_TYPE_TRIANGLE  1
-#define PRIMITIVE_TYPE_SPHERE    2
-#define PRIMITIVE_TYPE_COUNT     3
+/* shader storage buffer bindings, NOTE: scene sizes are passed as uniforms at runtime */
+#define SSBO_VERTICES     0
+#define SSBO_FACES        1
+#define SSBO_SPHERES      2
+#define SSBO_MATERIALS    3
+#define SSBO_LIGHTS       4
+#define SSBO_BVH          5
+#define SSBO_TRIANGLES    6
+#define SSBO_PATHS        7 // wavefront path state, one per pixel
+#define SSBO_QUEUES       8 // wavefront queue counters, also the indirect dispatch arguments
+#define SSBO_QUEUE_ITEMS  9 // wavefront queue entries (path indices)
+#define SSBO_NOISE       10 // noisy pixels of the progressive accumulation, one count per slot
+#define SSBO_TILES       11 // samples and error of every tile and the list of the tiles to trace
+#define SSBO_COUNT       12
+
+/* bounding volume hierarchy, see bvh.h */
+#ifndef BVH_ENABLE
+#define BVH_ENABLE        1 // 0 falls back to testing every primitive per ray (used by bench.sh)
+#endif
+#define BVH_STACK_SIZE   32 // traversal stack per shader invocation, also limits the depth of the tree
+
+/* triangle intersection, see triangle_t */
+#ifndef TRIANGLE_PRECOMPUTED
+#define TRIANGLE_PRECOMPUTED 1 // 0 intersects the vertices of the faces with a mat3 inverse per ray (used by bench.sh)
+#endif
+
+/* wavefront path tracing, see the passes at the end of compute.glsl */
+#ifndef WAVEFRONT_ENABLE
+#define WAVEFRONT_ENABLE  1 // 0 renders with the megakernel, one invocation does a whole path (used by bench.sh)
+#endif
+#define WAVEFRONT_GROUP_SIZE 64 // local_size_x of the passes that work through a queue
+#define MAX_BOUNCES        3 // closest hits per path
+#define MAX_LIGHTS        32 // bits in path_t.visible, lights past that are ignored
+
+/* queues between the wavefront passes, there is one of each kind per bounce, see queue_t */
+#define QUEUE_EXTEND      0 // paths that need a closest hit
+#define QUEUE_SHADOW      1 // same entries as QUEUE_SHADE, dispatched once per light
+#define QUEUE_SHADE       2 // paths that hit something
+#define QUEUE_KINDS       3
+#define QUEUE_COUNT      (QUEUE_KINDS * MAX_BOUNCES)
+#define QUEUE_GROUPS_X_MAX 65535 // smallest GL_MAX_COMPUTE_WORK_GROUP_COUNT, the work groups past it go into rows (groups_y)
+
+/* progressive rendering, see progressive.h */
+#define PROGRESSIVE_MIN_SAMPLES      4 // samples before the noise estimate of a pixel is trusted
+#define PROGRESSIVE_NOISE_THRESHOLD  (1.0 / 255) // standard error of the mean luminance of a converged pixel
+#define PROGRESSIVE_SLOT_COUNT       3 // frames whose noisy pixel counts can be in flight
+
+/* adaptive sampling, a tile is one work group and only tiles above the noise threshold get more samples */
+#define TILES_X(width)             (((width) + WORK_GROUP_SIZE_X - 1) / WORK_GROUP_SIZE_X) // NOTE: rounded up, the last column may stick out of the image
+#define TILES_Y(height)            (((height) + WORK_GROUP_SIZE_Y - 1) / WORK_GROUP_SIZE_Y)
+#define TILE_COUNT(width, height)  (TILES_X(width) * TILES_Y(height))
 
+/* used for lack of enums in glsl */
 #define MATERIAL_TYPE_NONE       0
 #define MATERIAL_TYPE_DIFFUSE    1
 #define MATERIAL_TYPE_SPECULAR   2
@@ -40,9 +89,31 @@ T(camera_t,     { vec4 pos;                          vec4 dir;
 
 T(material_t,   { uint type; float spec; float _[2]; vec4 color;                                                         })
 
-T(sphere_t,     { vec3 pos; float radius;                                                                                })
-T(triangle_t,   { vec3 a; float _1;                  vec3 b; float _2; vec3 c; float _3;                                 })
-T(primitive_t,  { uint type; float _unused[3];       sphere_t s;                         triangle_t t;   material_t mat; })
+/* NOTE: primitives are stored in one tightly packed buffer per type and reference their material by
+ * index into the material buffer. Triangles are faces whose idx points into the vertex buffer. */
+T(face_t,       { uvec3 idx; uint mat;                                                                                   })
+T(sphere_t,     { vec3 pos; float radius;            uint mat; uint _[3];                                                })
+
+/* NOTE: one per face and in the same order, with what the moller-trumbore intersection needs precomputed
+ * on the cpu: the first vertex, the edges to the other two and the unit geometric normal in the w components */
+T(triangle_t,   { vec3 a; float normal_x;            vec3 ab; float normal_y;  vec3 ac; float normal_z;                  })
+
+/* NOTE: interior nodes have count == 0 and their children at left_first and left_first + 1,
+ * leaves reference the primitives [left_first, left_first + count) */
+T(bvh_node_t,   { vec3 min; uint left_first;         vec3 max; uint count;                                               })
+
+/* NOTE: the first three members are the arguments of glDispatchComputeIndirect, groups_x and groups_y are counted
+ * up together with count while entries are pushed (rows of QUEUE_GROUPS_X_MAX work groups, see queue_group() in
+ * compute.glsl), so the next pass is sized by the previous one on the gpu. groups_z is the light of the shadow pass */
+T(queue_t,      { uint groups_x; uint groups_y;       uint groups_z; uint count;                                         })
+
+/* NOTE: error is the largest standard error of a pixel of the tile in its last sample (as uint bits, for atomicMax),
+ * queued is not about the tile itself, the n-th entry is the n-th tile to trace in this frame, see compact() */
+T(tile_t,       { uint samples; uint error;          uint queued; uint _;                                                })
+
+/* NOTE: state of the path of one pixel between the wavefront passes, the hit is filled in by extend and
+ * the bits of the lights that are not occluded by shadow */
+T(path_t,       { vec3 origin; int prim;             vec3 dir; float t;        vec3 normal; uint visible;  vec4 color;   })
 
 T(pointlight_t, { float intensity;                                                                                       })
 T(light_t,      { uint type; float _unused[3];       vec3 pos;  float _1;                vec4 color;     pointlight_t p; })
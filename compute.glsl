@@ -1,129 +1,392 @@
+#include "glsl.h"
 SHADER_VERSION_STRING
 #include "common.h"
 S(
 
 writeonly uniform image2D output_texture;
+layout(rgba32f, binding = 1) uniform image2D accum_texture; /* sum of the samples, see accumulate_sample() */
 
 /* uniforms */
 uniform camera_t camera;
+uniform uint     face_count;
+uniform uint     sphere_count;
+uniform uint     triangle_bvh_root; /* nodes from here on belong to the bvh over the faces that are not part of the mesh */
+uniform uint     sphere_bvh_root;   /* nodes from here on belong to the bvh over spheres */
+uniform uint     bounce;            /* of the wavefront pass being dispatched */
+uniform uint     noise_slot;        /* where the noisy pixels of this frame are counted */
+uniform uvec2    resolution;        /* traced rect of the images in pixels, see scale.h */
+uniform uint     tile_offset;       /* first entry of the tile list in the dispatch, see slice.h */
 
 /* shader storage buffer objects */
-layout(std430, binding = 0) buffer prim_buf  { primitive_t prims[]; };
-layout(std430, binding = 1) buffer light_buf { light_t lights[];    };
+layout(std430, binding = SSBO_VERTICES)    buffer vertex_buf     { vec4 vertices[];        };
+layout(std430, binding = SSBO_FACES)       buffer face_buf       { face_t faces[];         };
+layout(std430, binding = SSBO_SPHERES)     buffer sphere_buf     { sphere_t spheres[];     };
+layout(std430, binding = SSBO_MATERIALS)   buffer material_buf   { material_t materials[]; };
+layout(std430, binding = SSBO_LIGHTS)      buffer light_buf      { light_t lights[];       };
+layout(std430, binding = SSBO_BVH)         buffer bvh_buf        { bvh_node_t nodes[];     };
+layout(std430, binding = SSBO_TRIANGLES)   buffer triangle_buf   { triangle_t triangles[]; };
+layout(std430, binding = SSBO_PATHS)       buffer path_buf       { path_t paths[];         };
+layout(std430, binding = SSBO_QUEUES)      buffer queue_buf      { queue_t queues[];       };
+layout(std430, binding = SSBO_QUEUE_ITEMS) buffer queue_item_buf { uint queue_items[];     };
+layout(std430, binding = SSBO_NOISE)       buffer noise_buf      { uint noisy_pixels[];    };
+layout(std430, binding = SSBO_TILES)       buffer tile_buf       { queue_t tile_queue; tile_t tiles[]; };
 
 /* internal structs */
-struct ray_t { vec3  origin; vec3 dir;      };
-struct hit_t { float t;      vec3 normal;   }; /* returned by intersections */
+struct ray_t      { vec3  origin; vec3 dir;      };
+struct hit_t      { float t;      vec3 normal;   vec2 barycentric; }; /* returned by intersections, barycentric is (u, v) of b and c for triangles */
 
 /* constants */
 const float EPSILON         = 0.001f;
 const float FLOAT_MAX       = 3.402823466e+38;
-const uint  WIDTH           = WINDOW_WIDTH;    // from common.h
-const uint  HEIGHT          = WINDOW_HEIGHT;   // from common.h
-const uint  primitive_count = PRIMITIVE_COUNT; // from common.h
-const uint  light_count     = LIGHT_COUNT;     // from common.h
+
+/* variant of the scene and the options, defined in front of the source by pass_defines() in main.c */
+const uint  BOUNCES         = VARIANT_BOUNCES;  // closest hits per path, at most MAX_BOUNCES
+const uint  LIGHT_COUNT     = VARIANT_LIGHTS;   // at most MAX_LIGHTS
+const bool  HAS_FACES       = VARIANT_FACES != 0;
+const bool  HAS_SPHERES     = VARIANT_SPHERES != 0;
+const bool  ORTHOGRAPHIC    = VARIANT_ORTHOGRAPHIC != 0;
+
+/* returns the distance to the sphere along the ray or FLOAT_MAX if it is missed */
+float ray_sphere_distance(ray_t r, sphere_t s)
+{
+    vec3  difference   = r.origin - s.pos;
+    float a            = 1.0f;
+    float b            = 2.0f * dot(r.dir, difference);
+    float c            = dot(difference, difference) - s.radius * s.radius;
+    float discriminant = b * b - 4 * a * c;
+
+    /* see if ray intersects at all */
+    if (discriminant < 0) { return FLOAT_MAX; }
+    float root = sqrt(discriminant);
+
+    /* solve for t */
+    float q  = -0.5f * (b < 0 ? (b - root) : (b + root));
+    float t0 = q / a;
+    float t1 = c / q;
+    float t  = min(t0, t1);
+    if (t < EPSILON) { t = max(t0, t1); } /* too close to camera */
+
+    if (t < EPSILON) { t = FLOAT_MAX; }   /* still too close to camera */
+
+    return t;
+}
 
 hit_t ray_sphere_intersection(ray_t r, sphere_t s)
 {
     hit_t hit;
+    hit.t           = ray_sphere_distance(r, s);
+    hit.barycentric = vec2(0);
 
-    /* compute t */
-    {
-        vec3  difference   = r.origin - s.pos;
-        float a            = 1.0f;
-        float b            = 2.0f * dot(r.dir, difference);
-        float c            = dot(difference, difference) - s.radius * s.radius;
-        float discriminant = b * b - 4 * a * c;
+    /* set the normal at the hitpoint */
+    vec3 intersection = r.origin + hit.t * r.dir;
+    hit.normal = normalize(intersection - s.pos);
 
-        /* see if ray intersects at all */
-        if (discriminant < 0) { hit.t = FLOAT_MAX; return hit; }
-        float root = sqrt(discriminant);
+    return hit;
+}
 
-        /* solve for t */
-        float q  = -0.5f * (b < 0 ? (b - root) : (b + root));
-        float t0 = q / a;
-        float t1 = c / q;
-        float t  = min(t0, t1);
-        if (t < EPSILON) { t = max(t0, t1); } /* too close to camera */
+#if TRIANGLE_PRECOMPUTED
+/*
+ * moller-trumbore, see https://doi.org/10.1080/10867651.1997.10487468, with the edges and the normal
+ * precomputed when the scene is loaded (scene_build_triangles()) instead of being derived from the
+ * vertices for every ray
+ */
+hit_t ray_triangle_intersection(ray_t r, triangle_t tri)
+{
+    hit_t hit;
+    hit.t = FLOAT_MAX;
 
-        if (t < EPSILON) { t = FLOAT_MAX; }   /* still too close to camera */
+    vec3  p   = cross(r.dir, tri.ac);
+    float det = dot(tri.ab, p);
+    if (det == 0.0f) { return hit; } /* ray is parallel to the triangle */
 
-        hit.t = t;
-    }
+    float inv_det = 1.0f / det;
+    vec3  s       = r.origin - tri.a;
+    float u       = dot(s, p) * inv_det;
+    if (u < -EPSILON || u > (1 + EPSILON)) { return hit; }
 
-    /* set the normal at the hitpoint */
-    vec3 intersection = r.origin + hit.t * r.dir;
-    hit.normal = normalize(intersection - s.pos);
+    vec3  q = cross(s, tri.ab);
+    float v = dot(r.dir, q) * inv_det;
+    if (v < -EPSILON || v > (1 + EPSILON) || (u + v) > (1 + EPSILON)) { return hit; }
 
+    hit.t           = dot(tri.ac, q) * inv_det;
+    hit.normal      = vec3(tri.normal_x, tri.normal_y, tri.normal_z);
+    hit.barycentric = vec2(u, v);
     return hit;
 }
-
-hit_t ray_triangle_intersection(ray_t r, triangle_t t)
+#else
+/* solves origin + t * dir = a + u * (b - a) + v * (c - a) with the inverse of a mat3 per ray, compared against in bench.sh */
+hit_t ray_triangle_intersection(ray_t r, vec3 a, vec3 b, vec3 c)
 {
     hit_t hit;
+    hit.t = FLOAT_MAX;
 
-    vec3 a_to_b  = t.b - t.a;
-    vec3 a_to_c  = t.c - t.a;
+    vec3 a_to_b  = b - a;
+    vec3 a_to_c  = c - a;
 
     mat3 mat = mat3(a_to_b, a_to_c, -1.0f * r.dir);
 
     float det = determinant(mat);
 
-    if (det == 0.0f) { hit.t = FLOAT_MAX; return hit; } /* early out */
+    if (det == 0.0f) { return hit; } /* early out */
 
-    vec3 ray_to_a = r.origin - t.a;
+    vec3 ray_to_a = r.origin - a;
 
     vec3 dst = inverse(mat) * ray_to_a;
 
     if (dst.x >= -EPSILON && dst.x <= (1 + EPSILON)) {
         if (dst.y >= -EPSILON && dst.y <= (1 + EPSILON)) {
             if ((dst.x + dst.y) <= (1 + EPSILON)) {
-                hit.t = dst.z;
+                hit.t           = dst.z;
+                hit.normal      = normalize(cross(a_to_b, a_to_c));
+                hit.barycentric = dst.xy;
                 return hit;
             }
         }
     }
 
-    hit.t = FLOAT_MAX;
+    return hit;
+}
+#endif
+
+/* returns distance to the box along the ray or FLOAT_MAX if it is missed or further away than t_max */
+float ray_aabb_intersection(ray_t r, vec3 inv_dir, vec3 box_min, vec3 box_max, float t_max)
+{
+    vec3 t0 = (box_min - r.origin) * inv_dir;
+    vec3 t1 = (box_max - r.origin) * inv_dir;
+    vec3 t_small = min(t0, t1);
+    vec3 t_big   = max(t0, t1);
 
-    /* calculate normal */
+    float t_near = max(max(t_small.x, t_small.y), max(t_small.z, 0.0f));
+    float t_far  = min(min(t_big.x, t_big.y), t_big.z);
 
-    return hit;
+    return (t_near <= t_far && t_near < t_max) ? t_near : FLOAT_MAX;
 }
 
-vec4 shade(ray_t r, hit_t hit, int index)
+hit_t ray_face_intersection(ray_t r, uint face_idx)
 {
-    vec4 color     = vec4(0,0,0,1);
+    #if TRIANGLE_PRECOMPUTED
+    return ray_triangle_intersection(r, triangles[face_idx]);
+    #else
+    uvec3 idx = faces[face_idx].idx;
+    return ray_triangle_intersection(r, vertices[idx.x].xyz, vertices[idx.y].xyz, vertices[idx.z].xyz);
+    #endif
+}
 
-    material_t mat = prims[index].mat;
+/* NOTE: surfaces are numbered with the faces first followed by the spheres */
+material_t surface_material(int surface)
+{
+    if (surface < face_count) { return materials[faces[surface].mat]; }
+    return materials[spheres[surface - face_count].mat];
+}
 
-    vec3 intersection = r.origin + hit.t * r.dir;
+/* finds the closest surface along the ray, returns its index or -1 if nothing was hit */
+int closest_hit(ray_t r, out hit_t hit)
+{
+    int prim_idx    = -1;
+    hit.t           = FLOAT_MAX;
+    hit.normal      = vec3(0);
+    hit.barycentric = vec2(0);
+
+    #if BVH_ENABLE
+    /* NOTE: avoid 0 * inf = nan in the slab test for axis-aligned rays */
+    vec3 dir     = vec3(abs(r.dir.x) < 1e-20 ? 1e-20 : r.dir.x,
+                        abs(r.dir.y) < 1e-20 ? 1e-20 : r.dir.y,
+                        abs(r.dir.z) < 1e-20 ? 1e-20 : r.dir.z);
+    vec3 inv_dir = 1.0f / dir;
+
+    /* stack of nodes still to visit together with the distance at which the ray enters them */
+    uint  stack_node[BVH_STACK_SIZE];
+    float stack_t[BVH_STACK_SIZE];
+    int   stack_size = 0;
+
+    /* start with the roots of all trees */
+    uint roots[3] = uint[3](0, triangle_bvh_root, sphere_bvh_root);
+    for (int n = HAS_FACES ? 0 : 2; n < (HAS_SPHERES ? 3 : 2); n++)
+    {
+        float t = ray_aabb_intersection(r, inv_dir, nodes[roots[n]].min, nodes[roots[n]].max, hit.t);
+        if (t < FLOAT_MAX) { stack_node[stack_size] = roots[n]; stack_t[stack_size] = t; stack_size++; }
+    }
 
-    /* check if intersection is in shadow */
-    for (int i = 0; i < light_count; i++)
+    while (stack_size > 0)
     {
-        vec3 to_light = normalize(lights[i].pos - intersection);
+        stack_size--;
+        if (stack_t[stack_size] >= hit.t) { continue; } /* a closer hit was found in the meantime */
 
-        ray_t ray_to_light = {intersection, to_light};
-        bool is_in_shadow  = false;
+        uint       node_idx = stack_node[stack_size];
+        bvh_node_t node     = nodes[node_idx];
 
-        for (int prim_idx = 0; prim_idx < primitive_count; prim_idx++)
+        if (HAS_FACES && node.count > 0 && (!HAS_SPHERES || node_idx < sphere_bvh_root)) /* leaf with faces */
+        {
+            for (uint i = node.left_first; i < node.left_first + node.count; i++)
+            {
+                hit_t temp = ray_face_intersection(r, i);
+                if (temp.t < hit.t && temp.t >= EPSILON)
+                {
+                    hit      = temp;
+                    prim_idx = int(i);
+                }
+            }
+        }
+        else if (HAS_SPHERES && node.count > 0) /* leaf with spheres */
+        {
+            for (uint i = node.left_first; i < node.left_first + node.count; i++)
+            {
+                hit_t temp = ray_sphere_intersection(r, spheres[i]);
+                if (temp.t < hit.t && temp.t >= EPSILON)
+                {
+                    hit      = temp;
+                    prim_idx = int(face_count + i);
+                }
+            }
+        }
+        else /* interior node, visit the closer child first */
         {
-            hit_t temp = {FLOAT_MAX, vec3(0)};
-            switch (prims[prim_idx].type)
+            uint  left    = node.left_first;
+            uint  right   = node.left_first + 1;
+            float t_left  = ray_aabb_intersection(r, inv_dir, nodes[left].min,  nodes[left].max,  hit.t);
+            float t_right = ray_aabb_intersection(r, inv_dir, nodes[right].min, nodes[right].max, hit.t);
+
+            if (t_left > t_right)
             {
-                case PRIMITIVE_TYPE_TRIANGLE: { temp = ray_triangle_intersection(ray_to_light, prims[prim_idx].t); } break;
-                case PRIMITIVE_TYPE_SPHERE:   { temp = ray_sphere_intersection(ray_to_light,   prims[prim_idx].s); } break;
-                default: { } break;
+                uint  tmp_node = left;   left   = right;   right   = tmp_node;
+                float tmp_t    = t_left; t_left = t_right; t_right = tmp_t;
             }
 
-            if (temp.t < FLOAT_MAX && temp.t >= EPSILON && temp.t < length(intersection - lights[i].pos))
+            if (t_right < FLOAT_MAX) { stack_node[stack_size] = right; stack_t[stack_size] = t_right; stack_size++; }
+            if (t_left  < FLOAT_MAX) { stack_node[stack_size] = left;  stack_t[stack_size] = t_left;  stack_size++; }
+        }
+    }
+    #else
+    for (uint i = 0; HAS_FACES && i < face_count; i++)
+    {
+        hit_t temp = ray_face_intersection(r, i);
+        if (temp.t < hit.t && temp.t >= EPSILON)
+        {
+            hit      = temp;
+            prim_idx = int(i);
+        }
+    }
+    for (uint i = 0; HAS_SPHERES && i < sphere_count; i++)
+    {
+        hit_t temp = ray_sphere_intersection(r, spheres[i]);
+        if (temp.t < hit.t && temp.t >= EPSILON)
+        {
+            hit      = temp;
+            prim_idx = int(face_count + i);
+        }
+    }
+    #endif
+
+    return prim_idx;
+}
+
+/*
+ * occlusion query for shadow rays, returns true as soon as any surface is hit at a distance in
+ * [EPSILON, t_max) instead of looking for the closest one, and never computes a normal
+ */
+bool any_hit(ray_t r, float t_max)
+{
+    #if BVH_ENABLE
+    /* NOTE: avoid 0 * inf = nan in the slab test for axis-aligned rays */
+    vec3 dir     = vec3(abs(r.dir.x) < 1e-20 ? 1e-20 : r.dir.x,
+                        abs(r.dir.y) < 1e-20 ? 1e-20 : r.dir.y,
+                        abs(r.dir.z) < 1e-20 ? 1e-20 : r.dir.z);
+    vec3 inv_dir = 1.0f / dir;
+
+    /* NOTE: any hit ends the traversal, so unlike closest_hit() the stack needs no distances */
+    uint stack_node[BVH_STACK_SIZE];
+    int  stack_size = 0;
+
+    uint roots[3] = uint[3](0, triangle_bvh_root, sphere_bvh_root);
+    for (int n = HAS_FACES ? 0 : 2; n < (HAS_SPHERES ? 3 : 2); n++)
+    {
+        if (ray_aabb_intersection(r, inv_dir, nodes[roots[n]].min, nodes[roots[n]].max, t_max) < FLOAT_MAX) { stack_node[stack_size++] = roots[n]; }
+    }
+
+    while (stack_size > 0)
+    {
+        uint       node_idx = stack_node[--stack_size];
+        bvh_node_t node     = nodes[node_idx];
+
+        if (HAS_FACES && node.count > 0 && (!HAS_SPHERES || node_idx < sphere_bvh_root)) /* leaf with faces */
+        {
+            for (uint i = node.left_first; i < node.left_first + node.count; i++)
+            {
+                float t = ray_face_intersection(r, i).t;
+                if (t < t_max && t >= EPSILON) { return true; }
+            }
+        }
+        else if (HAS_SPHERES && node.count > 0) /* leaf with spheres */
+        {
+            for (uint i = node.left_first; i < node.left_first + node.count; i++)
             {
-                is_in_shadow = true;
+                float t = ray_sphere_distance(r, spheres[i]);
+                if (t < t_max && t >= EPSILON) { return true; }
             }
         }
+        else /* interior node, visit the closer child first, occluders tend to be close to the surface */
+        {
+            uint  left    = node.left_first;
+            uint  right   = node.left_first + 1;
+            float t_left  = ray_aabb_intersection(r, inv_dir, nodes[left].min,  nodes[left].max,  t_max);
+            float t_right = ray_aabb_intersection(r, inv_dir, nodes[right].min, nodes[right].max, t_max);
+
+            if (t_left > t_right) { uint tmp_node = left; left = right; right = tmp_node; float tmp_t = t_left; t_left = t_right; t_right = tmp_t; }
+
+            if (t_right < FLOAT_MAX) { stack_node[stack_size++] = right; }
+            if (t_left  < FLOAT_MAX) { stack_node[stack_size++] = left;  }
+        }
+    }
+    #else
+    for (uint i = 0; HAS_FACES && i < face_count; i++)
+    {
+        float t = ray_face_intersection(r, i).t;
+        if (t < t_max && t >= EPSILON) { return true; }
+    }
+    for (uint i = 0; HAS_SPHERES && i < sphere_count; i++)
+    {
+        float t = ray_sphere_distance(r, spheres[i]);
+        if (t < t_max && t >= EPSILON) { return true; }
+    }
+    #endif
+
+    return false;
+}
+
+/* ray from the intersection towards the light, dist is the distance between the two */
+ray_t light_ray(vec3 intersection, uint light, out float dist)
+{
+    vec3 to_light = lights[light].pos - intersection;
+    dist          = length(to_light);
+
+    ray_t ray_to_light = {intersection, to_light / dist};
+    return ray_to_light;
+}
+
+/* bit n is set if light n is not occluded, the megakernel does what the shadow pass does inline */
+uint visible_lights(vec3 intersection)
+{
+    uint visible = 0;
+    for (uint i = 0; i < LIGHT_COUNT; i++)
+    {
+        /* NOTE: only occluders between the intersection and the light matter */
+        float dist;
+        ray_t ray_to_light = light_ray(intersection, i, dist);
+        if (!any_hit(ray_to_light, dist)) { visible |= 1u << i; }
+    }
+    return visible;
+}
+
+/* light at the intersection from the lights that are visible (see visible_lights()) plus ambient */
+vec4 shade(vec3 intersection, int index, uint visible)
+{
+    vec4 color     = vec4(0,0,0,1);
+
+    material_t mat = surface_material(index);
 
-        if (!is_in_shadow)
+    for (uint i = 0; i < LIGHT_COUNT; i++)
+    {
+        if ((visible & (1u << i)) != 0)
         {
             float dist        = length(lights[i].pos - intersection);
             float attenuation = lights[i].p.intensity/dist;
@@ -139,100 +402,301 @@ vec4 shade(ray_t r, hit_t hit, int index)
     return color;
 }
 
-layout (local_size_x = WORK_GROUP_SIZE_X, local_size_y = WORK_GROUP_SIZE_Y, local_size_z = 1) in;
-void main() {
-    uint x = gl_GlobalInvocationID.x;
-    uint y = gl_GlobalInvocationID.y;
+/*
+ * adds the light at the hit to the color of the path and reflects the ray if the material is
+ * specular, b is the bounce of the hit. Returns false once the path ends.
+ */
+bool bounce_path(inout ray_t ray, inout vec4 color, hit_t hit, int index, uint visible, uint b)
+{
+    material_t mat          = surface_material(index);
+    vec3       intersection = ray.origin + hit.t * ray.dir;
+    vec4       temp_color   = shade(intersection, index, visible);
+
+    if (mat.type == MATERIAL_TYPE_SPECULAR)
+    {
+        color += mat.spec * temp_color;
+
+        /* compute reflection ray */
+        vec3 reflection = normalize(ray.dir - 2 * dot(ray.dir, hit.normal) * hit.normal);
+        ray.origin = intersection + reflection;
+        ray.dir    = reflection;
+        return true;
+    }
+
+    /* NOTE: the ray is not changed by diffuse surfaces, every bounce that is left would hit the same surface again */
+    for (uint n = b; n < BOUNCES; n++) { color += temp_color; }
+    return false;
+}
+
+const vec4 background_color = vec4(0.2,0.6,0.7,1);
+//const vec4 background_color = vec4(0,0,0,0); // transparent
+
+/* index of the work group in a dispatch over a queue, which may be more than one row of QUEUE_GROUPS_X_MAX, see queue_t */
+uint queue_group() { return gl_WorkGroupID.y * gl_NumWorkGroups.x + gl_WorkGroupID.x; }
+
+/* tile of the pixel, see compact() */
+uint pixel_tile(uint x, uint y) { return (y / WORK_GROUP_SIZE_Y) * TILES_X(resolution.x) + x / WORK_GROUP_SIZE_X; }
+
+/*
+ * pixel of the invocation in the passes that are dispatched over the tiles in the list of
+ * compact(), one work group each (starting at tile_offset). Returns false past the right and
+ * bottom edge of the image, where the last column and row of tiles stick out.
+ */
+bool tile_pixel(out uvec2 pixel)
+{
+    uint group = tile_offset + queue_group();
+    if (group >= tile_queue.count) { pixel = uvec2(0); return false; } /* NOTE: the last row of work groups is not full */
+
+    uint tile = tiles[group].queued;
+    pixel = uvec2(tile % TILES_X(resolution.x), tile / TILES_X(resolution.x)) * uvec2(WORK_GROUP_SIZE_X, WORK_GROUP_SIZE_Y) + gl_LocalInvocationID.xy;
+    return all(lessThan(pixel, resolution));
+}
+
+/* index of the sample of the pixel in this frame */
+uint pixel_sample(uint x, uint y) { return tiles[pixel_tile(x, y)].samples - 1; }
+
+/* pcg hash, see https://jcgt.org/published/0009/03/02/ */
+uint hash(uint v)
+{
+    uint state = v * 747796405u + 2891336453u;
+    uint word  = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+    return (word >> 22u) ^ word;
+}
 
-    const vec4 background_color = vec4(0.2,0.6,0.7,1);
-    //const vec4 background_color = vec4(0,0,0,0); // transparent
-    vec4 color = vec4(0); // final color of pixel on texture
+/* position of the sample inside the pixel, the first one is the center */
+vec2 pixel_jitter(uint x, uint y)
+{
+    uint sample_index = pixel_sample(x, y);
+    if (sample_index == 0) { return vec2(0.5); }
+    uint h = hash(hash(y * resolution.x + x) ^ sample_index);
+    return vec2(h & 0xffffu, h >> 16u) / 65536.0;
+}
 
-    /* init ray */
+ray_t camera_ray(uint x, uint y)
+{
     ray_t ray;
 
     // normalized device coordinates from (x,y) screen coords
-    vec2 ndc = vec2((x + 0.5) / WIDTH, (y + 0.5) / HEIGHT);
+    vec2 jitter = pixel_jitter(x, y);
+    vec2 ndc    = vec2((x + jitter.x) / resolution.x, (y + jitter.y) / resolution.y);
     ray.origin = camera.pos.xyz;
 
-    #if 0
+    if (ORTHOGRAPHIC)
     {  /* orthographic projection */
         ray.dir = normalize(camera.dir.xyz); // ray direction in camera space
         ray.origin.x += ndc.x;
         ray.origin.y += ndc.y;
         //ray.origin += ray.dir * 2.0 * ndc.x - camera.dir.xyz;
     }
-    #else
+    else
     { /* perspective projection */
         vec3 cam_dir = normalize(camera.dir.xyz);
         vec3 right   = normalize(cross(cam_dir, vec3(0, 1, 0)));
         vec3 up      = normalize(cross(right, cam_dir));
 
-        float aspect_ratio = float(WIDTH) / float(HEIGHT);
+        float aspect_ratio = float(resolution.x) / float(resolution.y);
         float fov = radians(CAMERA_FOV); // from common.h
         float tan_half_fov = tan(fov / 2.0);
 
         ray.dir = normalize(cam_dir + right * (2.0 * ndc.x - 1.0) * tan_half_fov * aspect_ratio + up * (1.0 - 2.0 * ndc.y) * tan_half_fov);
     }
-    #endif
 
-    /* check for intersections */
-    uint reflection_depth = 3;
+    return ray;
+}
+
+/*
+ * adds the sample to the accumulation image and writes the mean of all samples so far to the
+ * output texture. The alpha channel of the accumulation image holds the sum of the squared
+ * luminances, a pixel whose mean luminance has a standard error above PROGRESSIVE_NOISE_THRESHOLD
+ * is counted as noisy. The largest error goes to the tile of the pixel.
+ */
+void accumulate_sample(uint x, uint y, vec4 color)
+{
+    uint  tile         = pixel_tile(x, y);
+    uint  sample_index = tiles[tile].samples - 1;
+    float luminance    = dot(color.rgb, vec3(0.2126, 0.7152, 0.0722));
+    vec4  sum       = vec4(color.rgb, luminance * luminance);
+    if (sample_index > 0) { sum += imageLoad(accum_texture, ivec2(x, y)); }
+    imageStore(accum_texture, ivec2(x, y), sum);
+
+    float n    = float(sample_index + 1);
+    vec3  mean = sum.rgb / n;
+    imageStore(output_texture, ivec2(x, y), vec4(mean, 1));
+
+    if (sample_index + 1 >= PROGRESSIVE_MIN_SAMPLES)
     {
-        for (uint n = 0; n < reflection_depth; n++)
-        {
-            int tri_idx = -1; // TODO rename
-            int a,b;
-            hit_t hit   = { FLOAT_MAX, vec3(0,0,0) };
-            hit_t temp  = { FLOAT_MAX, vec3(0,0,0) };
+        float mean_luminance = dot(mean, vec3(0.2126, 0.7152, 0.0722));
+        float variance       = max(sum.a / n - mean_luminance * mean_luminance, 0.0);
+        float error          = sqrt(variance / n);
+        if (error > PROGRESSIVE_NOISE_THRESHOLD) { atomicAdd(noisy_pixels[noise_slot], 1); }
+        if (error > 0) { atomicMax(tiles[tile].error, floatBitsToUint(error)); } /* NOTE: the bits of positive floats order like the floats */
+    }
+}
 
-            /* compute intersection of ray and primitives */
-            for (int i = 0; i < primitive_count; i++)
-            {
-                switch (prims[i].type)
-                {
-                    case PRIMITIVE_TYPE_TRIANGLE: { temp = ray_triangle_intersection(ray, prims[i].t); } break;
-                    case PRIMITIVE_TYPE_SPHERE:   { temp = ray_sphere_intersection(ray, prims[i].s);   } break;
-                }
+/*
+ * puts the tiles that need another sample into the list the passes that start paths are
+ * dispatched over, one invocation per tile. The first PROGRESSIVE_MIN_SAMPLES samples are always
+ * taken, after that only while the error of the tile is above PROGRESSIVE_NOISE_THRESHOLD.
+ */
+void compact()
+{
+    uint tile = gl_GlobalInvocationID.x;
+    if (tile >= TILE_COUNT(resolution.x, resolution.y)) { return; }
+    if (tiles[tile].samples >= PROGRESSIVE_MIN_SAMPLES && uintBitsToFloat(tiles[tile].error) <= PROGRESSIVE_NOISE_THRESHOLD) { return; }
 
-                if (temp.t < hit.t && temp.t >= EPSILON) {
-                    hit     = temp;
-                    tri_idx = i;
-                }
-            }
+    tiles[tile].samples++;
+    tiles[tile].error = 0;
 
-            if (tri_idx != -1) /* ray hit triangle */
-            {
-                material_t mat = prims[tri_idx].mat;
+    uint slot = atomicAdd(tile_queue.count, 1);
+    if (slot < QUEUE_GROUPS_X_MAX)      { atomicAdd(tile_queue.groups_x, 1); }
+    if (slot % QUEUE_GROUPS_X_MAX == 0) { atomicAdd(tile_queue.groups_y, 1); }
+    tiles[slot].queued = tile;
+}
 
-                /* compute color */
-                vec4 temp_color = shade(ray, hit, tri_idx);
+/* the whole path of one pixel in one invocation */
+void megakernel()
+{
+    uvec2 pixel;
+    if (!tile_pixel(pixel)) { return; }
+    uint  x     = pixel.x;
+    uint  y     = pixel.y;
 
-                /* reflect if material is specular */
-                if (mat.type == MATERIAL_TYPE_SPECULAR)
-                {
-                    float spec  = mat.spec;
-                    color      += spec * temp_color;
-                    /* compute reflection ray */
-                    {
-                        vec3 intersection = ray.origin + hit.t * ray.dir;
-                        vec3 reflection   = normalize(ray.dir - 2 * dot(ray.dir, hit.normal) * hit.normal);
-
-                        ray.origin = intersection + reflection;
-                        ray.dir =  reflection;
-                    }
-                }
-                else // no reflection needed
-                {
-                    color += temp_color;
-                }
-            } else { /* hit nothing but the background */
-                color = background_color;
-                break; /* early return */
-            }
-        }
+    vec4  color = vec4(0); // final color of pixel on texture
+    ray_t ray   = camera_ray(x, y);
+
+    for (uint n = 0; n < BOUNCES; n++)
+    {
+        /* compute intersection of ray and primitives */
+        hit_t hit;
+        int prim_idx = closest_hit(ray, hit);
+
+        if (prim_idx == -1) { color = background_color; break; } /* hit nothing but the background */
+
+        vec3 intersection = ray.origin + hit.t * ray.dir;
+        if (!bounce_path(ray, color, hit, prim_idx, visible_lights(intersection), n)) { break; }
     }
 
-    imageStore(output_texture, ivec2(x, y), color);
+    accumulate_sample(x, y, color);
+}
+
+/*
+ * Wavefront passes, draw() runs generate, then extend, shadow and shade once per bounce and
+ * accumulate at the end. Every pass is a program of its own, so an invocation only does one kind
+ * of work, and passes hand the paths that are still alive to the next one through queues. The
+ * paths are compacted into the queues with atomics, which also count up the work groups of the
+ * next pass (see queue_t). draw() resets the queues every frame.
+ */
+
+/* NOTE: the entries of the queues are one pixel count apart, extend alternates between the first two, the hits use the third */
+uint queue_item(uint b, uint kind, uint slot) { return ((kind == QUEUE_EXTEND) ? b % 2 : 2) * (resolution.x * resolution.y) + slot; }
+
+/* counts the work group that starts at the entry at slot into the dispatch arguments of the queue */
+void count_group(uint queue, uint slot)
+{
+    if (slot % WAVEFRONT_GROUP_SIZE != 0) { return; }
+    uint group = slot / WAVEFRONT_GROUP_SIZE;
+    if (group < QUEUE_GROUPS_X_MAX)      { atomicAdd(queues[queue].groups_x, 1); }
+    if (group % QUEUE_GROUPS_X_MAX == 0) { atomicAdd(queues[queue].groups_y, 1); }
+}
+
+/* appends the path to the queue of bounce b */
+void push(uint b, uint kind, uint path_idx)
+{
+    uint queue = b * QUEUE_KINDS + kind;
+    uint slot  = atomicAdd(queues[queue].count, 1);
+    count_group(queue, slot);
+    if (kind == QUEUE_SHADE) { count_group(b * QUEUE_KINDS + QUEUE_SHADOW, slot); }
+    queue_items[queue_item(b, kind, slot)] = path_idx;
+}
+
+/* returns the path of the invocation in the queue of the current bounce or -1 past its end */
+int pop(uint kind)
+{
+    uint slot = queue_group() * WAVEFRONT_GROUP_SIZE + gl_LocalInvocationID.x;
+    if (slot >= queues[bounce * QUEUE_KINDS + kind].count) { return -1; }
+    return int(queue_items[queue_item(bounce, kind, slot)]);
+}
+
+/* camera rays of the pixels of the tiles in the list of compact() */
+void generate()
+{
+    uvec2 pixel;
+    if (!tile_pixel(pixel)) { return; }
+    uint  x        = pixel.x;
+    uint  y        = pixel.y;
+    uint  path_idx = y * resolution.x + x;
+
+    ray_t ray = camera_ray(x, y);
+    paths[path_idx].origin = ray.origin;
+    paths[path_idx].dir    = ray.dir;
+    paths[path_idx].color  = vec4(0);
+    push(0, QUEUE_EXTEND, path_idx);
+}
+
+/* closest hit of every path in the extend queue, paths that miss end with the background */
+void extend()
+{
+    int path_idx = pop(QUEUE_EXTEND);
+    if (path_idx < 0) { return; }
+
+    ray_t ray = {paths[path_idx].origin, paths[path_idx].dir};
+    hit_t hit;
+    int   prim_idx = closest_hit(ray, hit);
+
+    if (prim_idx == -1) { paths[path_idx].color = background_color; return; }
+
+    paths[path_idx].prim    = prim_idx;
+    paths[path_idx].t       = hit.t;
+    paths[path_idx].normal  = hit.normal;
+    paths[path_idx].visible = 0;
+    push(bounce, QUEUE_SHADE, uint(path_idx));
+}
+
+/* one shadow ray per hit and light (gl_WorkGroupID.z), sets the bit of the light if it is not occluded */
+void shadow()
+{
+    uint light    = gl_WorkGroupID.z;
+    int  path_idx = pop(QUEUE_SHADE);
+    if (path_idx < 0) { return; }
+
+    vec3  intersection = paths[path_idx].origin + paths[path_idx].t * paths[path_idx].dir;
+    float dist;
+    ray_t ray_to_light = light_ray(intersection, light, dist);
+    if (!any_hit(ray_to_light, dist)) { atomicOr(paths[path_idx].visible, 1u << light); }
 }
+
+/* adds the light at the hits to the paths and queues the reflected rays for the next bounce */
+void shade()
+{
+    int path_idx = pop(QUEUE_SHADE);
+    if (path_idx < 0) { return; }
+
+    ray_t ray   = {paths[path_idx].origin, paths[path_idx].dir};
+    vec4  color = paths[path_idx].color;
+    hit_t hit;
+    hit.t      = paths[path_idx].t;
+    hit.normal = paths[path_idx].normal;
+
+    bool alive = bounce_path(ray, color, hit, paths[path_idx].prim, paths[path_idx].visible, bounce);
+    paths[path_idx].color = color;
+    if (!alive || bounce + 1 >= BOUNCES) { return; }
+
+    paths[path_idx].origin = ray.origin;
+    paths[path_idx].dir    = ray.dir;
+    push(bounce + 1, QUEUE_EXTEND, uint(path_idx));
+}
+
+/* adds the colors of the paths of the tiles in the list of compact() to the accumulation image */
+void accumulate()
+{
+    uvec2 pixel;
+    if (!tile_pixel(pixel)) { return; }
+    uint  x     = pixel.x;
+    uint  y     = pixel.y;
+    accumulate_sample(x, y, paths[y * resolution.x + x].color);
+}
+
+/* NOTE: PASS_MAIN and the local sizes are defined in front of the source by pass_defines() in main.c */
+layout (local_size_x = PASS_SIZE_X, local_size_y = PASS_SIZE_Y, local_size_z = 1) in;
+void main() { PASS_MAIN(); }
 )
@@ -0,0 +1,819 @@
+/*
+ * CPU reference renderer, renders the same scene as the compute shader (see scene.h) on machines
+ * without a GPU and writes the image out as a binary ppm.
+ *
+ * Follows compute.glsl as closely as possible (same traversal order, same epsilons and the same
+ * order of float operations) so that its images can serve as a regression oracle for the shader,
+ * see the -c option. Compile with -ffp-contract=off so that no fused multiply-adds sneak in.
+ *
+ * The image is split into tiles of one work group each. Every thread works through its own queue
+ * of tiles first and steals from the other queues once it runs dry. Leaves of the bvh are tested
+ * against 8 triangles at once with AVX (4 with SSE, one by one without either).
+ *
+ * usage: cpu [-o output.ppm] [-t thread count] [-c reference.ppm] [-m ray count]
+ *
+ * -m only runs the microbenchmark of the triangle intersection kernels with that many rays.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>         // for sqrtf, tanf
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>       // for sysconf
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#define LANES 8
+typedef __m256 vfloat;
+#define v_set1(a)          _mm256_set1_ps(a)
+#define v_load(p)          _mm256_loadu_ps(p)
+#define v_store(p, a)      _mm256_storeu_ps(p, a)
+#define v_add(a, b)        _mm256_add_ps(a, b)
+#define v_sub(a, b)        _mm256_sub_ps(a, b)
+#define v_mul(a, b)        _mm256_mul_ps(a, b)
+#define v_div(a, b)        _mm256_div_ps(a, b)
+#define v_and(a, b)        _mm256_and_ps(a, b)
+#define v_ge(a, b)         _mm256_cmp_ps(a, b, _CMP_GE_OQ)
+#define v_le(a, b)         _mm256_cmp_ps(a, b, _CMP_LE_OQ)
+#define v_neq(a, b)        _mm256_cmp_ps(a, b, _CMP_NEQ_UQ)
+#define v_select(m, a, b)  _mm256_blendv_ps(b, a, m) /* m ? a : b */
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define LANES 4
+typedef __m128 vfloat;
+#define v_set1(a)          _mm_set1_ps(a)
+#define v_load(p)          _mm_loadu_ps(p)
+#define v_store(p, a)      _mm_storeu_ps(p, a)
+#define v_add(a, b)        _mm_add_ps(a, b)
+#define v_sub(a, b)        _mm_sub_ps(a, b)
+#define v_mul(a, b)        _mm_mul_ps(a, b)
+#define v_div(a, b)        _mm_div_ps(a, b)
+#define v_and(a, b)        _mm_and_ps(a, b)
+#define v_ge(a, b)         _mm_cmpge_ps(a, b)
+#define v_le(a, b)         _mm_cmple_ps(a, b)
+#define v_neq(a, b)        _mm_cmpneq_ps(a, b)
+#define v_select(m, a, b)  _mm_or_ps(_mm_and_ps(m, a), _mm_andnot_ps(m, b))
+#else
+#define LANES 1
+#endif
+
+typedef unsigned int uint;
+typedef struct vec3 { union { struct { float x,y,z; }; float e[3]; }; } vec3;
+typedef struct vec4 { union { struct { float x,y,z,w; }; float e[4]; }; } vec4;
+typedef struct uvec3 { union { struct { uint x,y,z; }; uint e[3]; }; } uvec3;
+
+#define T(name, def) typedef struct name def name;
+#include "common.h"
+#undef T
+
+#include "scene.h"
+
+#define TILE_SIZE_X WORK_GROUP_SIZE_X
+#define TILE_SIZE_Y WORK_GROUP_SIZE_Y
+#define MAX_THREADS 256
+#define FACE_PACKETS (LANES > 1 && BVH_ENABLE) // see face_packet_t
+
+/* same as in compute.glsl */
+typedef struct ray_t { vec3 origin; vec3 dir;    } ray_t;
+typedef struct hit_t { float t;     vec3 normal; float barycentric[2]; } hit_t;
+
+static const float EPSILON   = 0.001f;
+static const float FLOAT_MAX = 3.402823466e+38f;
+
+/* helper */
+static vec3  vec3_add(vec3 a, vec3 b)    { return (vec3){{{a.x + b.x, a.y + b.y, a.z + b.z}}}; }
+static vec3  vec3_sub(vec3 a, vec3 b)    { return (vec3){{{a.x - b.x, a.y - b.y, a.z - b.z}}}; }
+static vec3  vec3_mul(vec3 a, vec3 b)    { return (vec3){{{a.x * b.x, a.y * b.y, a.z * b.z}}}; }
+static vec3  vec3_scale(vec3 a, float s) { return (vec3){{{a.x * s, a.y * s, a.z * s}}}; }
+static float vec3_dot(vec3 a, vec3 b)    { return a.x * b.x + a.y * b.y + a.z * b.z; }
+static float vec3_length(vec3 a)         { return sqrtf(vec3_dot(a, a)); }
+static vec3  vec3_normalize(vec3 a)      { return vec3_scale(a, 1.0f / vec3_length(a)); }
+static vec3  vec3_cross(vec3 a, vec3 b)  { return (vec3){{{a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x}}}; }
+static vec3  vec3_min(vec3 a, vec3 b)    { return (vec3){{{a.x < b.x ? a.x : b.x, a.y < b.y ? a.y : b.y, a.z < b.z ? a.z : b.z}}}; }
+static vec3  vec3_max(vec3 a, vec3 b)    { return (vec3){{{a.x > b.x ? a.x : b.x, a.y > b.y ? a.y : b.y, a.z > b.z ? a.z : b.z}}}; }
+static float min_f(float a, float b)     { return a < b ? a : b; }
+static float max_f(float a, float b)     { return a > b ? a : b; }
+static vec4  vec4_add(vec4 a, vec4 b)    { return (vec4){{{a.x + b.x, a.y + b.y, a.z + b.z, a.w + b.w}}}; }
+static vec4  vec4_scale(vec4 a, float s) { return (vec4){{{a.x * s, a.y * s, a.z * s, a.w * s}}}; }
+
+/* returns the distance to the sphere along the ray or FLOAT_MAX if it is missed */
+static float ray_sphere_distance(ray_t r, const sphere_t* s)
+{
+    vec3  difference   = vec3_sub(r.origin, s->pos);
+    float a            = 1.0f;
+    float b            = 2.0f * vec3_dot(r.dir, difference);
+    float c            = vec3_dot(difference, difference) - s->radius * s->radius;
+    float discriminant = b * b - 4 * a * c;
+
+    /* see if ray intersects at all */
+    if (discriminant < 0) { return FLOAT_MAX; }
+    float root = sqrtf(discriminant);
+
+    /* solve for t */
+    float q  = -0.5f * (b < 0 ? (b - root) : (b + root));
+    float t0 = q / a;
+    float t1 = c / q;
+    float t  = min_f(t0, t1);
+    if (t < EPSILON) { t = max_f(t0, t1); } /* too close to camera */
+
+    if (t < EPSILON) { t = FLOAT_MAX; }     /* still too close to camera */
+
+    return t;
+}
+
+static hit_t ray_sphere_intersection(ray_t r, const sphere_t* s)
+{
+    hit_t hit = {0};
+    hit.t = ray_sphere_distance(r, s);
+
+    /* set the normal at the hitpoint */
+    vec3 intersection = vec3_add(r.origin, vec3_scale(r.dir, hit.t));
+    hit.normal = vec3_normalize(vec3_sub(intersection, s->pos));
+
+    return hit;
+}
+
+static vec3 vertex(const scene_t* scene, uint idx) { vec4 v = scene->vertices[idx]; return (vec3){{{v.x, v.y, v.z}}}; }
+
+/*
+ * moller-trumbore on the edges and the normal precomputed by scene_build_triangles(), same as
+ * ray_triangle_intersection() in compute.glsl, hit.t is FLOAT_MAX if the ray misses
+ */
+static hit_t ray_triangle_intersection(ray_t r, const triangle_t* tri)
+{
+    hit_t hit = {0};
+    hit.t = FLOAT_MAX;
+
+    vec3  p   = vec3_cross(r.dir, tri->ac);
+    float det = vec3_dot(tri->ab, p);
+    if (det == 0.0f) { return hit; } /* ray is parallel to the triangle */
+
+    float inv_det = 1.0f / det;
+    vec3  s       = vec3_sub(r.origin, tri->a);
+    float u       = vec3_dot(s, p) * inv_det;
+    if (u < -EPSILON || u > (1 + EPSILON)) { return hit; }
+
+    vec3  q = vec3_cross(s, tri->ab);
+    float v = vec3_dot(r.dir, q) * inv_det;
+    if (v < -EPSILON || v > (1 + EPSILON) || (u + v) > (1 + EPSILON)) { return hit; }
+
+    hit.t              = vec3_dot(tri->ac, q) * inv_det;
+    hit.normal         = (vec3){{{tri->normal_x, tri->normal_y, tri->normal_z}}};
+    hit.barycentric[0] = u;
+    hit.barycentric[1] = v;
+    return hit;
+}
+
+/*
+ * the kernel the shader uses with TRIANGLE_PRECOMPUTED 0: solves a + x * (b - a) + y * (c - a) =
+ * origin + t * dir with cramer's rule on the vertices of the face, which is what
+ * inverse(mat3(b - a, c - a, -dir)) * (origin - a) boils down to. Returns t or FLOAT_MAX if the ray
+ * misses, only kept for the microbenchmark (-m).
+ */
+static float ray_vertices_intersection(ray_t r, vec3 a, vec3 b, vec3 c)
+{
+    vec3 a_to_b  = vec3_sub(b, a);
+    vec3 a_to_c  = vec3_sub(c, a);
+    vec3 neg_dir = vec3_scale(r.dir, -1.0f);
+
+    vec3  cross_c_d = vec3_cross(a_to_c, neg_dir);
+    float det       = vec3_dot(a_to_b, cross_c_d);
+
+    if (det == 0.0f) { return FLOAT_MAX; } /* early out */
+
+    vec3 ray_to_a = vec3_sub(r.origin, a);
+
+    float x = vec3_dot(ray_to_a, cross_c_d) / det;
+    float y = vec3_dot(a_to_b, vec3_cross(ray_to_a, neg_dir)) / det;
+    float t = vec3_dot(a_to_b, vec3_cross(a_to_c, ray_to_a)) / det;
+
+    if (x >= -EPSILON && x <= (1 + EPSILON) && y >= -EPSILON && y <= (1 + EPSILON) && (x + y) <= (1 + EPSILON)) { return t; }
+    return FLOAT_MAX;
+}
+
+#if !FACE_PACKETS
+/* tests the faces [first, first + count) one after the other and keeps the closest hit */
+static void intersect_faces(const scene_t* scene, ray_t r, uint first, uint count, hit_t* hit, int* prim_idx)
+{
+    for (uint i = first; i < first + count; i++)
+    {
+        hit_t temp = ray_triangle_intersection(r, &scene->triangles[i]);
+        if (temp.t < hit->t && temp.t >= EPSILON)
+        {
+            *hit      = temp;
+            *prim_idx = (int) i;
+        }
+    }
+}
+
+#else
+/*
+ * the triangles of LANES faces of a bvh leaf transposed, so that a leaf is tested with straight
+ * vector loads. Lanes past the end of a leaf hold a degenerate triangle (det == 0) that never gets
+ * hit.
+ */
+typedef struct face_packet_t { float a[3][LANES]; float ab[3][LANES]; float ac[3][LANES]; } face_packet_t;
+
+static face_packet_t* face_packets;   /* packets of all leaves */
+static uint*          leaf_packets;   /* index of the first packet of every leaf, indexed by node */
+
+static void build_face_packets(const scene_t* scene)
+{
+    uint packet_count = 0;
+    leaf_packets = calloc(scene->node_count ? scene->node_count : 1, sizeof(uint));
+    for (uint n = 0; n < scene->sphere_bvh_root; n++)
+    {
+        leaf_packets[n] = packet_count;
+        packet_count   += (scene->nodes[n].count + LANES - 1) / LANES;
+    }
+
+    face_packets = calloc(packet_count ? packet_count : 1, sizeof(face_packet_t));
+    for (uint n = 0; n < scene->sphere_bvh_root; n++)
+    {
+        const bvh_node_t* node = &scene->nodes[n];
+        for (uint i = 0; i < node->count; i++)
+        {
+            face_packet_t*    packet = &face_packets[leaf_packets[n] + i / LANES];
+            const triangle_t* tri    = &scene->triangles[node->left_first + i];
+            for (int e = 0; e < 3; e++)
+            {
+                packet->a[e][i % LANES]  = tri->a.e[e];
+                packet->ab[e][i % LANES] = tri->ab.e[e];
+                packet->ac[e][i % LANES] = tri->ac.e[e];
+            }
+        }
+    }
+}
+
+/*
+ * tests all faces of a leaf, LANES at a time with the same operations as the scalar
+ * ray_triangle_intersection(), and keeps the closest hit. Picks the same face as testing them one
+ * after the other would (the lowest index wins on equal t).
+ */
+static void intersect_leaf(const scene_t* scene, ray_t r, uint node_idx, const bvh_node_t* node, hit_t* hit, int* prim_idx)
+{
+    vfloat eps     = v_set1(EPSILON);
+    vfloat neg_eps = v_set1(-EPSILON);
+    vfloat one_eps = v_set1(1 + EPSILON);
+    vfloat zero    = v_set1(0.0f);
+    vfloat one     = v_set1(1.0f);
+    vfloat d_x     = v_set1(r.dir.x),    d_y = v_set1(r.dir.y),    d_z = v_set1(r.dir.z);
+    vfloat o_x     = v_set1(r.origin.x), o_y = v_set1(r.origin.y), o_z = v_set1(r.origin.z);
+
+    const face_packet_t* packet = &face_packets[leaf_packets[node_idx]];
+    for (uint base = 0; base < node->count; base += LANES, packet++)
+    {
+        vfloat ab_x = v_load(packet->ab[0]), ab_y = v_load(packet->ab[1]), ab_z = v_load(packet->ab[2]);
+        vfloat ac_x = v_load(packet->ac[0]), ac_y = v_load(packet->ac[1]), ac_z = v_load(packet->ac[2]);
+
+        /* p = cross(dir, ac) */
+        vfloat p_x = v_sub(v_mul(d_y, ac_z), v_mul(d_z, ac_y));
+        vfloat p_y = v_sub(v_mul(d_z, ac_x), v_mul(d_x, ac_z));
+        vfloat p_z = v_sub(v_mul(d_x, ac_y), v_mul(d_y, ac_x));
+        vfloat det = v_add(v_add(v_mul(ab_x, p_x), v_mul(ab_y, p_y)), v_mul(ab_z, p_z));
+
+        vfloat inv_det = v_div(one, det);
+        vfloat s_x     = v_sub(o_x, v_load(packet->a[0])), s_y = v_sub(o_y, v_load(packet->a[1])), s_z = v_sub(o_z, v_load(packet->a[2]));
+        vfloat u       = v_mul(v_add(v_add(v_mul(s_x, p_x), v_mul(s_y, p_y)), v_mul(s_z, p_z)), inv_det);
+
+        /* q = cross(s, ab) */
+        vfloat q_x = v_sub(v_mul(s_y, ab_z), v_mul(s_z, ab_y));
+        vfloat q_y = v_sub(v_mul(s_z, ab_x), v_mul(s_x, ab_z));
+        vfloat q_z = v_sub(v_mul(s_x, ab_y), v_mul(s_y, ab_x));
+        vfloat v   = v_mul(v_add(v_add(v_mul(d_x, q_x), v_mul(d_y, q_y)), v_mul(d_z, q_z)), inv_det);
+        vfloat t   = v_mul(v_add(v_add(v_mul(ac_x, q_x), v_mul(ac_y, q_y)), v_mul(ac_z, q_z)), inv_det);
+
+        vfloat mask = v_neq(det, zero);
+        mask = v_and(mask, v_and(v_ge(u, neg_eps), v_le(u, one_eps)));
+        mask = v_and(mask, v_and(v_ge(v, neg_eps), v_le(v, one_eps)));
+        mask = v_and(mask, v_le(v_add(u, v), one_eps));
+        mask = v_and(mask, v_ge(t, eps));
+
+        float ts[LANES], us[LANES], vs[LANES];
+        v_store(ts, v_select(mask, t, v_set1(FLOAT_MAX)));
+        v_store(us, u);
+        v_store(vs, v);
+        for (uint lane = 0; lane < LANES && base + lane < node->count; lane++)
+        {
+            if (ts[lane] < hit->t)
+            {
+                const triangle_t* tri = &scene->triangles[node->left_first + base + lane];
+                hit->t              = ts[lane];
+                hit->normal         = (vec3){{{tri->normal_x, tri->normal_y, tri->normal_z}}};
+                hit->barycentric[0] = us[lane];
+                hit->barycentric[1] = vs[lane];
+                *prim_idx           = (int) (node->left_first + base + lane);
+            }
+        }
+    }
+}
+#endif
+
+/* returns distance to the box along the ray or FLOAT_MAX if it is missed or further away than t_max */
+static float ray_aabb_intersection(ray_t r, vec3 inv_dir, vec3 box_min, vec3 box_max, float t_max)
+{
+    vec3 t0      = vec3_mul(vec3_sub(box_min, r.origin), inv_dir);
+    vec3 t1      = vec3_mul(vec3_sub(box_max, r.origin), inv_dir);
+    vec3 t_small = vec3_min(t0, t1);
+    vec3 t_big   = vec3_max(t0, t1);
+
+    float t_near = max_f(max_f(t_small.x, t_small.y), max_f(t_small.z, 0.0f));
+    float t_far  = min_f(min_f(t_big.x, t_big.y), t_big.z);
+
+    return (t_near <= t_far && t_near < t_max) ? t_near : FLOAT_MAX;
+}
+
+static material_t* surface_material(const scene_t* scene, int surface)
+{
+    if ((uint) surface < scene->face_count) { return &scene->materials[scene->faces[surface].mat]; }
+    return &scene->materials[scene->spheres[surface - scene->face_count].mat];
+}
+
+/*
+ * finds the closest surface along the ray closer than t_max, returns its index or -1 if nothing
+ * was hit. With any set it returns the first surface it finds instead, see any_hit().
+ *
+ * NOTE: unlike in the shader, closest and any hit share one traversal here, a separate copy of
+ * it for any hit did the same work but ran about 30% slower on the cpu
+ */
+static int trace(const scene_t* scene, ray_t r, hit_t* hit, float t_max, int any)
+{
+    int prim_idx        = -1;
+    hit->t              = t_max;
+    hit->normal         = (vec3){{{0, 0, 0}}};
+    hit->barycentric[0] = 0;
+    hit->barycentric[1] = 0;
+
+    #if BVH_ENABLE
+    /* NOTE: avoid 0 * inf = nan in the slab test for axis-aligned rays */
+    vec3 dir     = {{{fabsf(r.dir.x) < 1e-20f ? 1e-20f : r.dir.x,
+                      fabsf(r.dir.y) < 1e-20f ? 1e-20f : r.dir.y,
+                      fabsf(r.dir.z) < 1e-20f ? 1e-20f : r.dir.z}}};
+    vec3 inv_dir = {{{1.0f / dir.x, 1.0f / dir.y, 1.0f / dir.z}}};
+
+    /* stack of nodes still to visit together with the distance at which the ray enters them */
+    uint  stack_node[BVH_STACK_SIZE];
+    float stack_t[BVH_STACK_SIZE];
+    int   stack_size = 0;
+
+    const bvh_node_t* nodes = scene->nodes;
+
+    /* start with the roots of all trees */
+    uint roots[3] = {0, scene->triangle_bvh_root, scene->sphere_bvh_root};
+    for (int n = 0; n < 3; n++)
+    {
+        float t = ray_aabb_intersection(r, inv_dir, nodes[roots[n]].min, nodes[roots[n]].max, hit->t);
+        if (t < FLOAT_MAX) { stack_node[stack_size] = roots[n]; stack_t[stack_size] = t; stack_size++; }
+    }
+
+    while (stack_size > 0)
+    {
+        stack_size--;
+        if (stack_t[stack_size] >= hit->t) { continue; } /* a closer hit was found in the meantime */
+
+        uint              node_idx = stack_node[stack_size];
+        const bvh_node_t* node     = &nodes[node_idx];
+
+        if (node->count > 0 && node_idx < scene->sphere_bvh_root) /* leaf with faces */
+        {
+            #if FACE_PACKETS
+            intersect_leaf(scene, r, node_idx, node, hit, &prim_idx);
+            #else
+            intersect_faces(scene, r, node->left_first, node->count, hit, &prim_idx);
+            #endif
+            if (any && prim_idx != -1) { return prim_idx; }
+        }
+        else if (node->count > 0) /* leaf with spheres */
+        {
+            for (uint i = node->left_first; i < node->left_first + node->count; i++)
+            {
+                hit_t temp = ray_sphere_intersection(r, &scene->spheres[i]);
+                if (temp.t < hit->t && temp.t >= EPSILON)
+                {
+                    *hit     = temp;
+                    prim_idx = (int) (scene->face_count + i);
+                    if (any) { return prim_idx; }
+                }
+            }
+        }
+        else /* interior node, visit the closer child first */
+        {
+            uint  left    = node->left_first;
+            uint  right   = node->left_first + 1;
+            float t_left  = ray_aabb_intersection(r, inv_dir, nodes[left].min,  nodes[left].max,  hit->t);
+            float t_right = ray_aabb_intersection(r, inv_dir, nodes[right].min, nodes[right].max, hit->t);
+
+            if (t_left > t_right)
+            {
+                uint  tmp_node = left;   left   = right;   right   = tmp_node;
+                float tmp_t    = t_left; t_left = t_right; t_right = tmp_t;
+            }
+
+            if (t_right < FLOAT_MAX) { stack_node[stack_size] = right; stack_t[stack_size] = t_right; stack_size++; }
+            if (t_left  < FLOAT_MAX) { stack_node[stack_size] = left;  stack_t[stack_size] = t_left;  stack_size++; }
+        }
+    }
+    #else
+    intersect_faces(scene, r, 0, scene->face_count, hit, &prim_idx);
+    for (uint i = 0; i < scene->sphere_count; i++)
+    {
+        hit_t temp = ray_sphere_intersection(r, &scene->spheres[i]);
+        if (temp.t < hit->t && temp.t >= EPSILON)
+        {
+            *hit     = temp;
+            prim_idx = (int) (scene->face_count + i);
+        }
+    }
+    #endif
+
+    return prim_idx;
+}
+
+/* finds the closest surface along the ray, returns its index or -1 if nothing was hit */
+static int closest_hit(const scene_t* scene, ray_t r, hit_t* hit) { return trace(scene, r, hit, FLOAT_MAX, 0); }
+
+/* any_hit() of compute.glsl, true as soon as any surface is hit at a distance in [EPSILON, t_max) */
+static int any_hit(const scene_t* scene, ray_t r, float t_max) { hit_t hit; return trace(scene, r, &hit, t_max, 1) != -1; }
+
+static vec4 shade(const scene_t* scene, ray_t r, hit_t hit, int index)
+{
+    vec4 color = {{{0, 0, 0, 1}}};
+
+    const material_t* mat = surface_material(scene, index);
+
+    vec3 intersection = vec3_add(r.origin, vec3_scale(r.dir, hit.t));
+
+    /* check if intersection is in shadow */
+    for (uint i = 0; i < scene->light_count; i++)
+    {
+        const light_t* light    = &scene->lights[i];
+        vec3           to_light = vec3_sub(light->pos, intersection);
+        float          dist     = vec3_length(to_light);
+
+        ray_t ray_to_light = {intersection, vec3_scale(to_light, 1.0f / dist)};
+        int   is_in_shadow = any_hit(scene, ray_to_light, dist);
+
+        if (!is_in_shadow)
+        {
+            float attenuation = light->p.intensity / dist;
+
+            color = vec4_add(color, vec4_scale(mat->color, attenuation));
+            color = vec4_add(color, vec4_scale(light->color, attenuation));
+        }
+    }
+
+    const float ambient_light_intensity = 0.1f;
+    color = vec4_add(color, vec4_scale(mat->color, ambient_light_intensity));
+
+    return color;
+}
+
+/* megakernel() of compute.glsl for a single pixel */
+static vec4 render_pixel(const scene_t* scene, const camera_t* camera, uint x, uint y)
+{
+    const vec4 background_color = {{{0.2f, 0.6f, 0.7f, 1}}};
+    vec4 color = {{{0, 0, 0, 0}}};
+
+    /* init ray, perspective projection */
+    ray_t ray;
+    {
+        float ndc_x = (x + 0.5f) / WINDOW_WIDTH;
+        float ndc_y = (y + 0.5f) / WINDOW_HEIGHT;
+        ray.origin  = (vec3){{{camera->pos.x, camera->pos.y, camera->pos.z}}};
+
+        vec3 cam_dir = vec3_normalize((vec3){{{camera->dir.x, camera->dir.y, camera->dir.z}}});
+        vec3 right   = vec3_normalize(vec3_cross(cam_dir, (vec3){{{0, 1, 0}}}));
+        vec3 up      = vec3_normalize(vec3_cross(right, cam_dir));
+
+        float aspect_ratio = (float) WINDOW_WIDTH / (float) WINDOW_HEIGHT;
+        float fov          = CAMERA_FOV * ((float) M_PI / 180.0f);
+        float tan_half_fov = tanf(fov / 2.0f);
+
+        /* NOTE: scaled one factor at a time like in the shader to get the same rounding */
+        vec3 offset_x = vec3_scale(vec3_scale(vec3_scale(right, 2.0f * ndc_x - 1.0f), tan_half_fov), aspect_ratio);
+        vec3 offset_y = vec3_scale(vec3_scale(up, 1.0f - 2.0f * ndc_y), tan_half_fov);
+        ray.dir       = vec3_normalize(vec3_add(vec3_add(cam_dir, offset_x), offset_y));
+    }
+
+    /* check for intersections */
+    for (uint n = 0; n < MAX_BOUNCES; n++)
+    {
+        hit_t hit;
+        int   surface = closest_hit(scene, ray, &hit);
+
+        if (surface == -1) { color = background_color; break; } /* hit nothing but the background */
+
+        const material_t* mat        = surface_material(scene, surface);
+        vec4              temp_color = shade(scene, ray, hit, surface);
+
+        /* reflect if material is specular */
+        if (mat->type == MATERIAL_TYPE_SPECULAR)
+        {
+            color = vec4_add(color, vec4_scale(temp_color, mat->spec));
+
+            vec3 intersection = vec3_add(ray.origin, vec3_scale(ray.dir, hit.t));
+            vec3 reflection   = vec3_normalize(vec3_sub(ray.dir, vec3_scale(hit.normal, 2 * vec3_dot(ray.dir, hit.normal))));
+
+            ray.origin = vec3_add(intersection, reflection);
+            ray.dir    = reflection;
+        }
+        else /* NOTE: the ray is not changed, every bounce that is left would hit the same surface again */
+        {
+            for (uint bounce = n; bounce < MAX_BOUNCES; bounce++) { color = vec4_add(color, temp_color); }
+            break;
+        }
+    }
+
+    return color;
+}
+
+/*
+ * queue of tiles [head, tail) owned by one thread, the owner takes tiles from the head while
+ * thieves take them from the tail. Both ends live in one 64 bit word so either side can claim a
+ * tile with a single compare and swap.
+ */
+typedef struct tile_queue_t
+{
+    _Atomic unsigned long long range; /* head in the low, tail in the high 32 bits */
+    char _pad[64 - sizeof(unsigned long long)]; /* NOTE: one cache line per queue */
+} tile_queue_t;
+
+static int tile_queue_pop(tile_queue_t* queue, int steal, uint* tile)
+{
+    unsigned long long range = atomic_load(&queue->range);
+    for (;;)
+    {
+        uint head = (uint) range;
+        uint tail = (uint) (range >> 32);
+        if (head >= tail) { return 0; } /* empty */
+
+        *tile = steal ? --tail : head++;
+        if (atomic_compare_exchange_weak(&queue->range, &range, ((unsigned long long) tail << 32) | head)) { return 1; }
+    }
+}
+
+typedef struct render_job_t
+{
+    const scene_t*  scene;
+    camera_t        camera;
+    unsigned char*  pixels;  /* rgb, WINDOW_WIDTH * WINDOW_HEIGHT */
+    tile_queue_t*   queues;  /* one per thread */
+    uint            thread_count;
+} render_job_t;
+
+typedef struct worker_t
+{
+    render_job_t* job;
+    uint          id;
+    uint          tiles;     /* rendered by this thread */
+    uint          stolen;    /* of those, taken from other queues */
+    pthread_t     thread;
+} worker_t;
+
+static void render_tile(render_job_t* job, uint tile)
+{
+    uint tiles_x = (WINDOW_WIDTH + TILE_SIZE_X - 1) / TILE_SIZE_X;
+    uint x0      = (tile % tiles_x) * TILE_SIZE_X;
+    uint y0      = (tile / tiles_x) * TILE_SIZE_Y;
+
+    for (uint y = y0; y < y0 + TILE_SIZE_Y && y < WINDOW_HEIGHT; y++)
+    {
+        for (uint x = x0; x < x0 + TILE_SIZE_X && x < WINDOW_WIDTH; x++)
+        {
+            vec4 color = render_pixel(job->scene, &job->camera, x, y);
+
+            /* NOTE: same conversion as imageStore into the GL_RGBA8 texture */
+            unsigned char* pixel = &job->pixels[3 * (y * WINDOW_WIDTH + x)];
+            for (int c = 0; c < 3; c++)
+            {
+                float value = color.e[c] < 0.0f ? 0.0f : (color.e[c] > 1.0f ? 1.0f : color.e[c]);
+                pixel[c]    = (unsigned char) (value * 255.0f + 0.5f);
+            }
+        }
+    }
+}
+
+static void* worker_main(void* arg)
+{
+    worker_t*     worker = arg;
+    render_job_t* job    = worker->job;
+    uint          tile;
+
+    for (;;)
+    {
+        if (tile_queue_pop(&job->queues[worker->id], 0, &tile)) { render_tile(job, tile); worker->tiles++; continue; }
+
+        /* own queue ran dry, go through the others once and steal from the first one with work left */
+        int found = 0;
+        for (uint n = 1; n < job->thread_count && !found; n++)
+        {
+            found = tile_queue_pop(&job->queues[(worker->id + n) % job->thread_count], 1, &tile);
+        }
+        if (!found) { break; } /* NOTE: queues only ever shrink, so everything is taken */
+
+        render_tile(job, tile);
+        worker->tiles++;
+        worker->stolen++;
+    }
+    return NULL;
+}
+
+static double seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* reads a binary ppm of the same size as the image, returns NULL on failure */
+static unsigned char* read_ppm(const char* path)
+{
+    FILE* file = fopen(path, "rb");
+    if (!file) { return NULL; }
+
+    int width, height, max;
+    unsigned char* pixels = NULL;
+    if (fscanf(file, "P6 %d %d %d", &width, &height, &max) == 3 && fgetc(file) != EOF &&
+        width == WINDOW_WIDTH && height == WINDOW_HEIGHT && max == 255)
+    {
+        pixels = malloc(3 * WINDOW_WIDTH * WINDOW_HEIGHT);
+        if (fread(pixels, 3, WINDOW_WIDTH * WINDOW_HEIGHT, file) != WINDOW_WIDTH * WINDOW_HEIGHT) { free(pixels); pixels = NULL; }
+    }
+    fclose(file);
+    return pixels;
+}
+
+/*
+ * microbenchmark of the triangle kernels (-m ray count), tests rays from the camera in
+ * pseudo-random directions against every face of the scene with the kernel on the vertices, the
+ * precomputed one and the precomputed one LANES faces at a time
+ */
+static void benchmark_triangles(const scene_t* scene, uint ray_count)
+{
+    ray_t* rays = malloc(sizeof(ray_t) * ray_count);
+    uint   seed = 1;
+    for (uint n = 0; n < ray_count; n++)
+    {
+        float e[2];
+        for (int i = 0; i < 2; i++) { seed = seed * 1664525u + 1013904223u; e[i] = (seed >> 8) / 16777216.0f * 2.0f - 1.0f; }
+        rays[n] = (ray_t){{{{0, 0, 0}}}, vec3_normalize((vec3){{{e[0], e[1], -1}}})};
+    }
+    double tests = (double) ray_count * scene->face_count / 1e6;
+    double start;
+    uint   hits;
+
+    /* NOTE: the hit counts keep the compiler from dropping the loops, the first two must agree */
+    start = seconds(); hits = 0;
+    for (uint n = 0; n < ray_count; n++)
+    {
+        for (uint i = 0; i < scene->face_count; i++)
+        {
+            const face_t* face = &scene->faces[i];
+            float t = ray_vertices_intersection(rays[n], vertex(scene, face->idx.x), vertex(scene, face->idx.y), vertex(scene, face->idx.z));
+            hits += (t >= EPSILON && t < FLOAT_MAX);
+        }
+    }
+    printf("vertices, cramer's rule:      %7.1f M tests/s (%u hits)\n", tests / (seconds() - start), hits);
+
+    start = seconds(); hits = 0;
+    for (uint n = 0; n < ray_count; n++)
+    {
+        for (uint i = 0; i < scene->face_count; i++)
+        {
+            hit_t hit = ray_triangle_intersection(rays[n], &scene->triangles[i]);
+            hits += (hit.t >= EPSILON && hit.t < FLOAT_MAX);
+        }
+    }
+    printf("precomputed, moller-trumbore: %7.1f M tests/s (%u hits)\n", tests / (seconds() - start), hits);
+
+    #if FACE_PACKETS
+    /* NOTE: goes through the faces leaf by leaf, only the closest hit of every leaf is counted */
+    start = seconds(); hits = 0;
+    for (uint n = 0; n < ray_count; n++)
+    {
+        for (uint node_idx = 0; node_idx < scene->sphere_bvh_root; node_idx++)
+        {
+            const bvh_node_t* node = &scene->nodes[node_idx];
+            if (node->count == 0) { continue; }
+
+            hit_t hit      = {0};
+            int   prim_idx = -1;
+            hit.t = FLOAT_MAX;
+            intersect_leaf(scene, rays[n], node_idx, node, &hit, &prim_idx);
+            hits += (prim_idx != -1);
+        }
+    }
+    printf("precomputed, %i-wide packets:  %7.1f M tests/s (%u leaves hit)\n", LANES, tests / (seconds() - start), hits);
+    #endif
+
+    free(rays);
+}
+
+int main(int argc, char** argv)
+{
+    const char* output_path    = "cpu.ppm";
+    const char* reference_path = NULL;
+    long        thread_count   = sysconf(_SC_NPROCESSORS_ONLN);
+    long        ray_count      = 0;
+
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+        if      (strcmp(argv[i], "-o") == 0) { output_path    = argv[i + 1];       }
+        else if (strcmp(argv[i], "-t") == 0) { thread_count   = atol(argv[i + 1]); }
+        else if (strcmp(argv[i], "-c") == 0) { reference_path = argv[i + 1];       }
+        else if (strcmp(argv[i], "-m") == 0) { ray_count      = atol(argv[i + 1]); }
+        else { printf("usage: %s [-o output.ppm] [-t thread count] [-c reference.ppm] [-m ray count]\n", argv[0]); return 1; }
+    }
+    if (thread_count < 1)           { thread_count = 1;           }
+    if (thread_count > MAX_THREADS) { thread_count = MAX_THREADS; }
+
+    scene_t scene = {0};
+    if (!scene_load(&scene)) { return 1; }
+    #if FACE_PACKETS
+    build_face_packets(&scene);
+    #endif
+
+    if (ray_count > 0)
+    {
+        benchmark_triangles(&scene, (uint) ray_count);
+        #if FACE_PACKETS
+        free(face_packets);
+        free(leaf_packets);
+        #endif
+        scene_free(&scene);
+        return 0;
+    }
+
+    /* NOTE: same camera the compute shader starts with, see on_load() in main.c */
+    render_job_t job = {0};
+    job.scene        = &scene;
+    job.camera.dir   = (vec4){{{0, 0, -1, 1}}};
+    job.pixels       = malloc(3 * WINDOW_WIDTH * WINDOW_HEIGHT);
+    job.queues       = aligned_alloc(64, sizeof(tile_queue_t) * thread_count);
+    job.thread_count = (uint) thread_count;
+
+    /* hand out contiguous runs of tiles so neighbouring (similarly expensive) tiles stay on one thread */
+    uint tile_count = ((WINDOW_WIDTH + TILE_SIZE_X - 1) / TILE_SIZE_X) * ((WINDOW_HEIGHT + TILE_SIZE_Y - 1) / TILE_SIZE_Y);
+    for (uint n = 0; n < job.thread_count; n++)
+    {
+        unsigned long long head = (unsigned long long) tile_count * n / job.thread_count;
+        unsigned long long tail = (unsigned long long) tile_count * (n + 1) / job.thread_count;
+        atomic_init(&job.queues[n].range, (tail << 32) | head);
+    }
+
+    double   start = seconds();
+    worker_t workers[MAX_THREADS] = {{0}};
+    for (uint n = 0; n < job.thread_count; n++)
+    {
+        workers[n].job = &job;
+        workers[n].id  = n;
+        pthread_create(&workers[n].thread, NULL, worker_main, &workers[n]);
+    }
+    uint stolen = 0;
+    for (uint n = 0; n < job.thread_count; n++)
+    {
+        pthread_join(workers[n].thread, NULL);
+        stolen += workers[n].stolen;
+    }
+    printf("Rendered %u tiles on %u threads (%u stolen, %i-wide triangle tests) in %.1f ms\n", tile_count,
+           job.thread_count, stolen, LANES, 1000.0 * (seconds() - start));
+
+    FILE* file = fopen(output_path, "wb");
+    if (!file) { printf("Could not open %s\n", output_path); return 1; }
+    /* NOTE: pixel row 0 is the bottom of the window (see the blit in main.c), the ppm starts with the top row like the recorded frames */
+    fprintf(file, "P6 %d %d 255\n", WINDOW_WIDTH, WINDOW_HEIGHT);
+    for (int y = WINDOW_HEIGHT - 1; y >= 0; y--) { fwrite(job.pixels + 3 * y * WINDOW_WIDTH, 3, WINDOW_WIDTH, file); }
+    fclose(file);
+
+    /* compare against an image of the compute shader, small differences are expected on silhouettes */
+    int result = 0;
+    if (reference_path)
+    {
+        unsigned char* reference = read_ppm(reference_path);
+        if (!reference) { printf("Could not read %s as a %ix%i ppm\n", reference_path, WINDOW_WIDTH, WINDOW_HEIGHT); return 1; }
+
+        uint differ = 0, max_diff = 0;
+        for (uint i = 0; i < WINDOW_WIDTH * WINDOW_HEIGHT; i++)
+        {
+            uint flipped = (WINDOW_HEIGHT - 1 - i / WINDOW_WIDTH) * WINDOW_WIDTH + i % WINDOW_WIDTH; /* NOTE: the reference starts with the top row */
+            uint diff    = 0;
+            for (int c = 0; c < 3; c++) { uint d = abs(job.pixels[3 * i + c] - reference[3 * flipped + c]); diff = d > diff ? d : diff; }
+            if (diff > 1) { differ++; } /* NOTE: allow off by one from rounding */
+            max_diff = diff > max_diff ? diff : max_diff;
+        }
+        printf("%u of %u pixels differ from %s (max difference %u)\n", differ, WINDOW_WIDTH * WINDOW_HEIGHT, reference_path, max_diff);
+
+        /* NOTE: fail if more than 0.1% of the pixels differ */
+        result = differ * 1000 > WINDOW_WIDTH * WINDOW_HEIGHT;
+        free(reference);
+    }
+
+    #if FACE_PACKETS
+    free(face_packets);
+    free(leaf_packets);
+    #endif
+    free(job.queues);
+    free(job.pixels);
+    scene_free(&scene);
+    return result;
+}
@@ -9,11 +9,12 @@ terminate_program()
 
 trap terminate_program EXIT # call on exit
 
-watched_files="main.c|compute.glsl|common.h"
+# NOTE: compute.glsl is not rebuilt, main recompiles only the compute programs when it changes (--watch-shader)
+watched_files="main.c|glsl.h|common.h|scene.h|bvh.h|record.h|timer.h|bench.h|profile.h|progressive.h|scale.h|slice.h|binary_cache.h|shader_watch.h"
 
 ./build.sh
 
-MESA_GLSL_VERSION_OVERRIDE=430 MESA_GL_VERSION_OVERRIDE=4.3FC ./main &
+MESA_GLSL_VERSION_OVERRIDE=430 MESA_GL_VERSION_OVERRIDE=4.3FC ./main --watch-shader &
 bg_pid=$! # capture pid of program
 
 # rebuild dll if source file changed
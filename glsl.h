@@ -0,0 +1,16 @@
+/*
+ * Macros that turn glsl in c files into strings, used by main.c for its shaders and by
+ * compute.glsl, which includes this itself so it can also be preprocessed on its own (see
+ * shader_watch.h).
+ *
+ * NOTE: T() declares the structs of common.h, which main.c also includes as c with a T() of its own.
+ */
+#ifndef GLSL_H
+#define GLSL_H
+
+#define _STRINGIFY(...) #__VA_ARGS__ "\n"
+#define S(...) _STRINGIFY(__VA_ARGS__)
+#define T(name,def) "struct " #name " " #def ";\n"
+#define SHADER_VERSION_STRING "#version 430 core\n"
+
+#endif
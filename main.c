@@ -8,6 +8,7 @@
 typedef unsigned int uint;
 typedef struct vec3 { union { struct { float x,y,z; }; float e[3]; }; } vec3;
 typedef struct vec4 { union { struct { float x,y,z,w; }; float e[4]; }; } vec4; // TODO use for vertex
+typedef struct uvec3 { union { struct { uint x,y,z; }; uint e[3]; }; } uvec3;
 typedef struct vertex_t {
     float x,y,z,w;
     float u,v; // NOTE unused
@@ -17,22 +18,29 @@ typedef struct vertex_t {
 #include "common.h"
 #undef T
 
-#define _STRINGIFY(...) #__VA_ARGS__ "\n"
-#define S(...) _STRINGIFY(__VA_ARGS__)
-#define T(name,def) "struct " #name " " #def ";\n"
-#define SHADER_VERSION_STRING "#version 430 core\n"
-
-
-/* NOTE: "string too big" error on msvc */
-char teapot_obj[] = ""
-//                   #include "teapot.obj.inc"
-                   ;
-
-#define TINYOBJ_LOADER_C_IMPLEMENTATION
-#include "tinyobj_loader_c.h"
+/* options of the exe that the dll needs to know about, passed to on_load() */
+typedef struct config_t
+{
+    int headless;    /* no window and no blit of the texture, see create_headless_context() */
+    int frame_count; /* exit after this many frames, 0 keeps running until the window is closed */
+    const char* record_path; /* printf pattern for the recorded frames, NULL records nothing, see record.h */
+    const char* bench_path;  /* json output of the benchmark mode, NULL disables it, see bench.h */
+    const char* profile_path; /* "-" prints the gpu time of every stage of draw(), anything else is a chrome trace, see profile.h */
+    int progressive_samples;  /* samples per pixel to accumulate while the camera does not move, 0 renders one per frame, see progressive.h */
+    int width;       /* of the window and the images, follows the window when it is resized, 0 is WINDOW_WIDTH */
+    int height;
+    float frame_budget_ms; /* gpu time of a frame to hold by tracing fewer pixels, 0 traces all of them, see scale.h */
+    float slice_budget_ms; /* gpu time of the tiles traced per draw(), 0 traces the whole image at once, see slice.h */
+    int bounces;      /* closest hits per path, 0 is MAX_BOUNCES, see variant_t */
+    int orthographic; /* projection of the camera, see variant_t */
+    const char* shader_cache_path; /* directory of the program binaries, NULL compiles every program from source, see binary_cache.h */
+    int watch_shader; /* recompile the compute programs when compute.glsl changes on disk, see shader_watch.h */
+} config_t;
+
+#include "glsl.h"
+
+#define STATE_SIZE (1024 * 1024) // bytes the exe allocates for state_t, see state_header_t
 
-primitive_t prim_buf[PRIMITIVE_COUNT];
-light_t     light_buf[LIGHT_COUNT];
 
 #ifdef COMPILE_DLL
 #if defined(_MSC_VER)
@@ -41,14 +49,143 @@ light_t     light_buf[LIGHT_COUNT];
     #define EXPORT __attribute__((visibility("default")))
 #endif
 
+#include <stdint.h> // for uint64_t
+
+#include "scene.h"
+#include "record.h"
+#include "timer.h"
+#include "bench.h"
+#include "profile.h"
+#include "progressive.h"
+#include "scale.h"
+#include "slice.h"
+#include "binary_cache.h"
+#include "shader_watch.h"
+
+
+/* entry points of compute.glsl, every one is compiled into a program of its own, see start_pass() */
+#define PASS_MEGAKERNEL   0
+#define PASS_COMPACT      1
+#define PASS_GENERATE     2
+#define PASS_EXTEND       3
+#define PASS_SHADOW       4
+#define PASS_SHADE        5
+#define PASS_ACCUMULATE   6
+#define PASS_COUNT        7
+
+typedef struct pass_t
+{
+    const char* main;   /* function in compute.glsl */
+    int         size_x; /* local size */
+    int         size_y;
+} pass_t;
 
+static const pass_t passes[PASS_COUNT] =
+{
+    { "megakernel", WORK_GROUP_SIZE_X,    WORK_GROUP_SIZE_Y },
+    { "compact",    WAVEFRONT_GROUP_SIZE, 1                 },
+    { "generate",   WORK_GROUP_SIZE_X,    WORK_GROUP_SIZE_Y },
+    { "extend",     WAVEFRONT_GROUP_SIZE, 1                 },
+    { "shadow",     WAVEFRONT_GROUP_SIZE, 1                 },
+    { "shade",      WAVEFRONT_GROUP_SIZE, 1                 },
+    { "accumulate", WORK_GROUP_SIZE_X,    WORK_GROUP_SIZE_Y },
+};
+
+/*
+ * Constants of compute.glsl that depend on the scene and the options. They are defined in front
+ * of the source (see pass_defines()), so the compiler can drop the code of primitives the scene
+ * does not have and unroll the loops over bounces and lights.
+ */
+typedef struct variant_t
+{
+    uint bounces;      /* closest hits per path, at most MAX_BOUNCES */
+    uint lights;       /* at most MAX_LIGHTS */
+    int  faces;        /* the scene has faces */
+    int  spheres;      /* the scene has spheres */
+    int  orthographic; /* projection of the camera, perspective otherwise */
+} variant_t;
+
+/* compiled passes of all variants that were used, see request_program() */
+#define PROGRAM_CACHE_SIZE  32 // once full, the oldest program that is neither in use nor part of the build in progress is deleted
+_Static_assert(PROGRAM_CACHE_SIZE > 2 * PASS_COUNT, "the program cache has to hold the programs in use and those of a build");
+
+typedef struct program_cache_t
+{
+    uint64_t     hash[PROGRAM_CACHE_SIZE]; /* of the defines, the source and the driver */
+    unsigned int program_id[PROGRAM_CACHE_SIZE];
+    uint         count;
+    uint         oldest; /* replaced next once the cache is full */
+} program_cache_t;
+
+/*
+ * The programs that on_load() asked for, the ones that are not in a cache are compiled in the
+ * background (with parallel shader compile). draw() keeps dispatching the programs of the last
+ * build until all of these linked, see poll_programs().
+ */
+typedef struct program_build_t
+{
+    int          active;
+    unsigned int program_id[PASS_COUNT]; /* 0 for the passes that are not used */
+    unsigned int shader_id[PASS_COUNT];  /* of the programs that are compiled, 0 for the ones of a cache */
+    uint64_t     hash[PASS_COUNT];
+    variant_t    variant;
+} program_build_t;
+
+/* gl buffer that only ever grows, see upload_ssbo() */
+typedef struct gpu_buffer_t
+{
+    unsigned int id;
+    size_t       capacity; /* in bytes */
+    size_t       size;     /* of the last upload */
+    uint64_t     hash;     /* of the data of the last upload, 0 for storage that the shaders write */
+} gpu_buffer_t;
+
+/*
+ * Versioned layout of state_t, so a hot reload of a dll with another state_t keeps what it can
+ * instead of reading the old bytes as the new fields. The header at the start of the state
+ * remembers the offset and size of every field (see STATE_FIELDS) of the dll that wrote it.
+ * on_load() moves the fields that still exist with the same size to their new offset and zeroes
+ * the others, which then start over like on the first load (see migrate_state()). A change that
+ * keeps the name and the size of a field but not its meaning needs a new STATE_VERSION and a
+ * function in state_migrations that fixes the field up.
+ */
+#define STATE_MAGIC      0x54415453u // "STAT", changes with the layout of state_header_t
+#define STATE_VERSION    1
+#define STATE_FIELD_MAX  64
+
+typedef struct state_field_t
+{
+    uint64_t name;   /* hash of the name */
+    uint32_t offset;
+    uint32_t size;
+} state_field_t;
+
+typedef struct state_header_t
+{
+    uint32_t      magic;
+    uint32_t      version;
+    uint32_t      size;        /* sizeof(state_t) */
+    uint32_t      field_count;
+    uint64_t      layout;      /* hash of the fields, equal layouts need no migration */
+    state_field_t field[STATE_FIELD_MAX];
+} state_header_t;
+
+/*
+ * Everything that is kept across hot reloads. NOTE: owns every gl object the dll creates, which
+ * on_load() creates only once and reuses (or replaces) on the next load instead of leaking them.
+ */
 typedef struct state_t
 {
+    state_header_t header; /* NOTE: first, at the same offset in every version */
+
     int initialized;
 
     /* create texture */
     unsigned int texture_id;
     unsigned int texture_format;
+    unsigned int accum_texture_id; /* RGBA32F sum of the samples, see progressive.h */
+    uint         width;  /* of both textures, see resize_images() */
+    uint         height;
 
     /* generate vao & vbo for texture */
     unsigned int texture_vbo;
@@ -63,43 +200,503 @@ typedef struct state_t
     /* create shader */
     unsigned int shader_program_id;
 
-    /* create compute shader & program */
-    unsigned int compute_shader_id;
-    unsigned int cs_program_id;
+    /* create compute programs, one per pass (0 for the passes that are not used) */
+    unsigned int cs_program_id[PASS_COUNT];
+    variant_t       variant;       /* of the programs in cs_program_id */
+    program_cache_t program_cache; /* NOTE: kept across hot reloads, so is the gl context */
+    program_build_t program_build; /* replaces cs_program_id once it is done compiling */
+    int             parallel_compile; /* the driver compiles in the background, see poll_programs() */
+
+    /* uniforms that only depend on the scene, set on every program that is swapped in */
+    uint face_count;
+    uint sphere_count;
+    uint triangle_bvh_root;
+    uint sphere_bvh_root;
+
+    /* shader storage buffers, indexed by their binding (see common.h) */
+    gpu_buffer_t ssbo[SSBO_COUNT];
 
     /* movable camera */
     camera_t camera;
+
+    /* copy of the options of the exe, updated on every load */
+    config_t config;
+
+    /* asynchronous read back of the frames, see record.h */
+    record_t record;
+
+    /* frame time statistics of the benchmark mode, see bench.h */
+    bench_t bench;
+
+    /* gpu time of every stage of draw(), see profile.h */
+    profile_t profile;
+
+    /* accumulation of samples while the camera does not move, see progressive.h */
+    progressive_t progressive;
+
+    /* rect of the images that is traced to hold the frame budget, see scale.h */
+    scale_t scale;
+
+    /* the part of the tiles of an image that is traced per draw(), see slice.h */
+    slice_t slice;
+
+    /* the texture holds the finished image of image_camera with the current scene and programs, draw() only shows it again */
+    int      image_valid;
+    camera_t image_camera;
+
+    /* changes of compute.glsl on disk, see shader_watch.h */
+    shader_watch_t shader_watch;
 } state_t;
 
-void GLAPIENTRY gl_debug_callback(GLenum source, GLenum type, GLuint id, GLenum severity, GLsizei length, const GLchar* message, const void* userParam) { fprintf(stderr, "%s\n", message); }
-void get_file_data(void* c, const char* f, int m, const char* o, char **buf, size_t *len) { *buf = teapot_obj; *len = sizeof(teapot_obj);}
-EXPORT int on_load(state_t* state)
-{
-    /* test obj file loading */
-    {
-        tinyobj_attrib_t attrib;
-        tinyobj_shape_t* shapes = NULL;
-        size_t num_shapes;
-        tinyobj_material_t* materials = NULL;
-        size_t num_materials;
-        unsigned int flags = TINYOBJ_FLAG_TRIANGULATE;
-
-        int ret = tinyobj_parse_obj(&attrib, &shapes, &num_shapes, &materials,
-                                    &num_materials, "teapot.obj", get_file_data, NULL, flags);
-        if (ret != TINYOBJ_SUCCESS) {
-            printf("Failure\n");
+_Static_assert(sizeof(state_t) <= STATE_SIZE, "state_t does not fit into the state the exe allocates");
+
+/* NOTE: every field of state_t but the header, a field that is missing here starts over on every hot reload */
+#define STATE_FIELDS(F) \
+    F(initialized) F(texture_id) F(texture_format) F(accum_texture_id) F(width) F(height) F(texture_vbo) F(texture_vao) \
+    F(vertex_shader_id) F(frag_shader_id) F(shader_program_id) F(cs_program_id) F(variant) F(program_cache) F(program_build) \
+    F(parallel_compile) F(face_count) F(sphere_count) F(triangle_bvh_root) F(sphere_bvh_root) F(ssbo) F(camera) F(config) \
+    F(record) F(bench) F(profile) F(progressive) F(scale) F(slice) F(image_valid) F(image_camera) \
+    F(shader_watch)
+
+/* fixes up the fields of a state of the previous version after migrate_state() moved them, old is a copy of the whole old state */
+typedef void (*state_migration_t)(state_t* state, const unsigned char* old);
+
+/* indexed by the version they migrate from, NULL when moving the fields is enough */
+static const state_migration_t state_migrations[STATE_VERSION] = { NULL };
+
+
+/* FNV-1a, see http://www.isthe.com/chongo/tech/comp/fnv/ */
+#define HASH_SEED 0xcbf29ce484222325ull
+uint64_t hash_string(uint64_t hash, const char* string)
+{
+    for (; string && *string; string++) { hash = (hash ^ (unsigned char) *string) * 0x100000001b3ull; }
+    return hash;
+}
+
+uint64_t hash_bytes(uint64_t hash, const void* data, size_t size)
+{
+    for (size_t n = 0; n < size; n++) { hash = (hash ^ ((const unsigned char*) data)[n]) * 0x100000001b3ull; }
+    return hash;
+}
+
+/* the header of the state_t of this dll */
+void state_layout(state_header_t* header)
+{
+    memset(header, 0, sizeof(state_header_t));
+    header->magic   = STATE_MAGIC;
+    header->version = STATE_VERSION;
+    header->size    = sizeof(state_t);
+    header->layout  = HASH_SEED;
+    #define F(name) \
+    { \
+        state_field_t field = { hash_string(HASH_SEED, #name), offsetof(state_t, name), sizeof(((state_t*) 0)->name) }; \
+        assert(header->field_count < STATE_FIELD_MAX); \
+        header->field[header->field_count++] = field; \
+        header->layout = hash_bytes(header->layout, &field, sizeof(field)); \
+    }
+    STATE_FIELDS(F)
+    #undef F
+}
+
+/*
+ * Brings a state that was written by a dll with another state_t into the layout of this one,
+ * see state_header_t. Called first thing by on_load(), the state of the first load is all zeros.
+ */
+void migrate_state(state_t* state)
+{
+    state_header_t current;
+    state_layout(&current);
+
+    state_header_t* header = &state->header;
+    if (header->magic == 0) { state->header = current; return; } /* NOTE: first load */
+    if (header->magic == STATE_MAGIC && header->version == current.version && header->layout == current.layout) { return; }
+
+    /* NOTE: a state of an unknown header starts over */
+    uint32_t       old_size = (header->magic == STATE_MAGIC && header->size <= STATE_SIZE) ? header->size : 0;
+    unsigned char* old      = malloc(old_size ? old_size : 1);
+    memcpy(old, state, old_size);
+    memset(state, 0, sizeof(state_t));
+
+    const state_header_t* old_header = (const state_header_t*) old;
+    uint kept = 0;
+    for (uint i = 0; old_size && i < current.field_count; i++)
+    {
+        for (uint j = 0; j < old_header->field_count && j < STATE_FIELD_MAX; j++)
+        {
+            const state_field_t* from = &old_header->field[j];
+            const state_field_t* to   = &current.field[i];
+            if (from->name != to->name || from->size != to->size || from->offset + from->size > old_size) { continue; }
+            memcpy((unsigned char*) state + to->offset, old + from->offset, to->size);
+            kept++;
+            break;
+        }
+    }
+
+    /* NOTE: a dll of an older version may come back after a newer one, then there is nothing to fix up */
+    for (uint version = old_size ? old_header->version : STATE_VERSION; version < STATE_VERSION; version++)
+    {
+        if (state_migrations[version]) { state_migrations[version](state, old); }
+    }
+
+    printf("Migrated the state from version %u to %u, kept %u of %u fields\n", old_size ? old_header->version : 0, STATE_VERSION, kept, current.field_count);
+    state->header = current;
+    free(old);
+}
+
+/*
+ * Uploads size bytes into the shader storage buffer and binds it to binding, returns the bytes
+ * it uploaded. The storage is orphaned with glBufferData so dispatches that are still in flight
+ * keep the old contents, and it is grown (but never shrunk) when the scene outgrows it. Data
+ * that is the same as the last upload (a hot reload of an unchanged scene) is not uploaded
+ * again. With data NULL the storage is only allocated, for buffers that are written by the
+ * shaders, and kept as long as it is large enough.
+ */
+size_t upload_ssbo(gpu_buffer_t* buffer, uint binding, const void* data, size_t size)
+{
+    uint64_t hash    = data ? hash_bytes(HASH_SEED, data, size) : 0;
+    int      created = !buffer->id;
+    int      same    = !created && size <= buffer->capacity && (data ? (size == buffer->size && hash == buffer->hash) : !buffer->hash);
+    if (created) { glGenBuffers(1, &buffer->id); }
+
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer->id);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, binding, buffer->id);
+    if (same) { return 0; }
+
+    if (size > buffer->capacity)
+    {
+        buffer->capacity = (size > 2 * buffer->capacity) ? size : 2 * buffer->capacity;
+    }
+    if (buffer->capacity == 0) { buffer->capacity = 256; } /* NOTE avoid binding zero-sized buffers for empty scenes */
+    buffer->size = size;
+    buffer->hash = hash;
+
+    glBufferData(GL_SHADER_STORAGE_BUFFER, buffer->capacity, NULL, GL_STATIC_DRAW);
+    if (data) { glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, size, data); }
+    return data ? size : 0;
+}
+
+/* defines that select the pass and the variant, they go between the #version line and the rest of compute.glsl */
+void pass_defines(char* defines, size_t size, int pass, const variant_t* variant)
+{
+    snprintf(defines, size, "#define PASS_MAIN %s\n#define PASS_SIZE_X %d\n#define PASS_SIZE_Y %d\n"
+             "#define VARIANT_BOUNCES %u\n#define VARIANT_LIGHTS %u\n#define VARIANT_FACES %d\n#define VARIANT_SPHERES %d\n#define VARIANT_ORTHOGRAPHIC %d\n",
+             passes[pass].main, passes[pass].size_x, passes[pass].size_y,
+             variant->bounces, variant->lights, variant->faces, variant->spheres, variant->orthographic);
+}
+
+/*
+ * Starts compiling one entry point of compute.glsl into a program with the defines of
+ * pass_defines(). With parallel shader compile this returns before the driver is done, the
+ * errors are only checked by finish_pass().
+ */
+unsigned int start_pass(const char* cs_source, const char* defines, unsigned int* shader_id)
+{
+    const char* sources[3] = { SHADER_VERSION_STRING, defines, cs_source + strlen(SHADER_VERSION_STRING) };
+
+    *shader_id = glCreateShader(GL_COMPUTE_SHADER);
+    glShaderSource(*shader_id, 3, sources, NULL);
+    glCompileShader(*shader_id);
+
+    unsigned int program_id = glCreateProgram();
+    glAttachShader(program_id, *shader_id);
+    glProgramParameteri(program_id, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE); /* see binary_cache.h */
+    glLinkProgram(program_id);
+    return program_id;
+}
+
+/* waits for the program of start_pass() and deletes its shader, returns 0 (and deletes the program too) on failure */
+unsigned int finish_pass(unsigned int program_id, unsigned int shader_id, int pass)
+{
+    /* print any compile errors */
+    int success;
+    char infoLog[512];
+    glGetShaderiv(shader_id, GL_COMPILE_STATUS, &success);
+    if(!success)
+    {
+        glGetShaderInfoLog(shader_id, 512, NULL, infoLog);
+        printf("Compute shader compilation failed (%s): %s\n", passes[pass].main, infoLog);
+        glDeleteProgram(program_id);
+        glDeleteShader(shader_id);
+        return 0;
+    }
+    glDetachShader(program_id, shader_id);
+    glDeleteShader(shader_id);
+
+    /* print any linking errors */
+    glGetProgramiv(program_id, GL_LINK_STATUS, &success);
+    if(!success)
+    {
+        glGetProgramInfoLog(program_id, 512, NULL, infoLog);
+        printf("Shader linking failed (%s): %s\n", passes[pass].main, infoLog);
+        glDeleteProgram(program_id);
+        return 0;
+    }
+    return program_id;
+}
+
+/* adds a program to the cache, NOTE: never deletes one that draw() still dispatches or that the build in progress holds */
+void cache_program(state_t* state, uint64_t hash, unsigned int program_id)
+{
+    program_cache_t* cache = &state->program_cache;
+    uint n = cache->count;
+    if (n == PROGRAM_CACHE_SIZE)
+    {
+        for (int in_use = 1; in_use; )
+        {
+            n             = cache->oldest;
+            cache->oldest = (cache->oldest + 1) % PROGRAM_CACHE_SIZE;
+            in_use        = 0;
+            for (int pass = 0; pass < PASS_COUNT; pass++)
+            {
+                in_use |= (state->cs_program_id[pass] == cache->program_id[n]);
+                in_use |= (state->program_build.active && state->program_build.program_id[pass] == cache->program_id[n]);
+            }
+        }
+        glDeleteProgram(cache->program_id[n]);
+    }
+    else { cache->count++; }
+    cache->hash[n]       = hash;
+    cache->program_id[n] = program_id;
+}
+
+/*
+ * Puts the program of the pass for the variant of the build into the build. Programs are cached
+ * by a hash of their defines, the source and the driver, so switching back to a variant or a hot
+ * reload that changes neither the shader nor the scene does not compile anything. Programs that
+ * are not in memory yet are loaded from the binaries on disk if there are any (see
+ * binary_cache.h), the others are started compiling. Returns 1 if it had to compile.
+ */
+int request_program(state_t* state, const char* cs_source, int pass)
+{
+    program_build_t* build = &state->program_build;
+    char defines[512];
+    pass_defines(defines, sizeof(defines), pass, &build->variant);
+    uint64_t hash = hash_string(hash_string(HASH_SEED, defines), cs_source);
+    hash = hash_string(hash, (const char*) glGetString(GL_VENDOR));
+    hash = hash_string(hash, (const char*) glGetString(GL_RENDERER));
+    hash = hash_string(hash, (const char*) glGetString(GL_VERSION));
+    build->hash[pass]      = hash;
+    build->shader_id[pass] = 0;
+
+    program_cache_t* cache = &state->program_cache;
+    for (uint n = 0; n < cache->count; n++)
+    {
+        if (cache->hash[n] == hash) { build->program_id[pass] = cache->program_id[n]; return 0; }
+    }
+
+    const char* dir = binary_cache_supported() ? state->config.shader_cache_path : NULL;
+    build->program_id[pass] = dir ? binary_cache_load(dir, hash) : 0;
+    if (build->program_id[pass]) { cache_program(state, hash, build->program_id[pass]); return 0; }
+
+    build->program_id[pass] = start_pass(cs_source, defines, &build->shader_id[pass]);
+    return 1;
+}
+
+/* deletes the programs of a build that are still compiling, the ones of the cache stay */
+void discard_programs(state_t* state)
+{
+    program_build_t* build = &state->program_build;
+    for (int pass = 0; pass < PASS_COUNT; pass++)
+    {
+        if (!build->shader_id[pass]) { continue; }
+        glDeleteProgram(build->program_id[pass]);
+        glDeleteShader(build->shader_id[pass]);
+        build->shader_id[pass] = 0;
+    }
+    build->active = 0;
+}
+
+/* starts a build of the programs of all passes that draw() dispatches, returns how many of them have to be compiled */
+uint build_programs(state_t* state, const char* cs_source)
+{
+    program_build_t* build = &state->program_build;
+    uint compiling = 0;
+
+    /* NOTE: active before the first request, so cache_program() keeps the programs of the earlier passes */
+    memset(build->program_id, 0, sizeof(build->program_id));
+    memset(build->shader_id,  0, sizeof(build->shader_id));
+    build->active = 1;
+    for (int pass = 0; pass < PASS_COUNT; pass++)
+    {
+        if (pass != PASS_COMPACT && (pass == PASS_MEGAKERNEL) == WAVEFRONT_ENABLE) { continue; }
+        compiling += request_program(state, cs_source, pass);
+    }
+    return compiling;
+}
+
+/* compute.glsl from disk, preprocessed with the options the dll was built with, see shader_watch.h */
+char* load_shader_source(void)
+{
+    char options[256];
+    snprintf(options, sizeof(options), "-DWORK_GROUP_SIZE_X=%d -DWORK_GROUP_SIZE_Y=%d -DBVH_ENABLE=%d -DTRIANGLE_PRECOMPUTED=%d -DWAVEFRONT_ENABLE=%d",
+             WORK_GROUP_SIZE_X, WORK_GROUP_SIZE_Y, BVH_ENABLE, TRIANGLE_PRECOMPUTED, WAVEFRONT_ENABLE);
+    return shader_watch_load(options);
+}
+
+/* recompiles the compute programs from compute.glsl on disk, see shader_watch.h, they are swapped in by poll_programs() */
+void reload_shader(state_t* state)
+{
+    char* cs_source = load_shader_source();
+    if (!cs_source) { printf("Keeping the previous programs\n"); return; }
+
+    /* NOTE: the variant of a build that is still compiling is newer than the one in use */
+    program_build_t* build   = &state->program_build;
+    variant_t        variant = build->active ? build->variant : state->variant;
+    discard_programs(state);
+    build->variant = variant;
+
+    uint compiling = build_programs(state, cs_source);
+    free(cs_source);
+    if (compiling) { printf("Compiling %u programs of %s in the background\n", compiling, SHADER_PATH); }
+}
+
+/* sets the uniforms of the scene on the programs of all passes, NOTE: uniforms are kept by the program object, so only when the scene or the programs change */
+void set_scene_uniforms(state_t* state, const unsigned int* program_ids)
+{
+    for (int pass = 0; pass < PASS_COUNT; pass++)
+    {
+        unsigned int program_id = program_ids[pass];
+        if (!program_id) { continue; }
+        glUseProgram(program_id);
+        glUniform1ui(glGetUniformLocation(program_id, "face_count"),        state->face_count);
+        glUniform1ui(glGetUniformLocation(program_id, "sphere_count"),      state->sphere_count);
+        glUniform1ui(glGetUniformLocation(program_id, "triangle_bvh_root"), state->triangle_bvh_root);
+        glUniform1ui(glGetUniformLocation(program_id, "sphere_bvh_root"),   state->sphere_bvh_root);
+    }
+}
+
+/*
+ * Swaps the programs of the build in once all of them are done compiling (or right away with
+ * wait), returns 1 if it did. A build with a program that fails to compile is dropped and the
+ * programs of the last build stay, so a typo in the shader does not stop the renderer.
+ */
+int poll_programs(state_t* state, int wait)
+{
+    program_build_t* build = &state->program_build;
+    if (!build->active) { return 0; }
+
+    /* NOTE: without parallel shader compile the status can only be known by waiting */
+    uint compiled = 0;
+    for (int pass = 0; pass < PASS_COUNT; pass++)
+    {
+        if (!build->shader_id[pass]) { continue; }
+        int done = 1;
+        if (!wait && state->parallel_compile) { glGetProgramiv(build->program_id[pass], GL_COMPLETION_STATUS_KHR, &done); }
+        if (!done) { return 0; }
+        compiled++;
+    }
+
+    for (int pass = 0; pass < PASS_COUNT; pass++)
+    {
+        if (!build->shader_id[pass]) { continue; }
+        unsigned int program_id = finish_pass(build->program_id[pass], build->shader_id[pass], pass);
+        build->shader_id[pass]  = 0;
+        if (!program_id)
+        {
+            discard_programs(state);
+            printf("Keeping the previous programs\n");
             return 0;
         }
-        printf("# of shapes    = %d\n", (int)num_shapes);
-        printf("# of materials = %d\n", (int)num_materials);
-        printf("# of vertices = %d\n", attrib.num_vertices);
-        printf("# of faces    = %d\n", attrib.num_faces);
+        cache_program(state, build->hash[pass], program_id);
+        if (state->config.shader_cache_path && binary_cache_supported()) { binary_cache_store(state->config.shader_cache_path, build->hash[pass], program_id); }
+    }
+
+    for (int pass = 0; pass < PASS_COUNT; pass++) { state->cs_program_id[pass] = build->program_id[pass]; }
+    set_scene_uniforms(state, state->cs_program_id);
+    state->variant = build->variant;
+    build->active  = 0;
+    printf("Variant with %u bounces, %u lights,%s%s %s projection (compiled %u programs)\n", state->variant.bounces, state->variant.lights,
+           state->variant.faces ? " faces," : "", state->variant.spheres ? " spheres," : "", state->variant.orthographic ? "orthographic" : "perspective", compiled);
+
+    /* NOTE: the image in progress was traced with the previous programs */
+    slice_reset(&state->slice);
+    progressive_reset(&state->progressive);
+    state->image_valid = 0;
+    return 1;
+}
+
+/*
+ * (Re)allocates everything that has the size of the image: both textures, the path state and
+ * queue entries of the wavefront passes and the tiles. Called at the end of on_load() and by
+ * resize(). Starts the progressive image over and, when recording, continues in a new recording
+ * of the new size. NOTE: draw() only traces the rect of scale.h, which is passed as resolution.
+ */
+void resize_images(state_t* state, uint width, uint height)
+{
+    /* NOTE: the blit stretches the texture over the whole window, even if it had to be made smaller */
+    if (!state->config.headless) { glViewport(0, 0, width, height); }
+
+    int max_size = 0;
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_size);
+    if (width > (uint) max_size || height > (uint) max_size)
+    {
+        printf("Images of %ux%u are larger than the maximum texture size %i\n", width, height, max_size);
+        if (width  > (uint) max_size) { width  = max_size; }
+        if (height > (uint) max_size) { height = max_size; }
+    }
+    /* NOTE: a hot reload keeps the textures if they already have the size */
+    int resized = !state->accum_texture_id || width != state->width || height != state->height;
+    state->width  = width;
+    state->height = height;
+
+    glActiveTexture(GL_TEXTURE0 + 0);
+    glBindTexture(GL_TEXTURE_2D, state->texture_id);
+    if (resized) { glTexImage2D(GL_TEXTURE_2D, 0, state->texture_format, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, 0); }
+    glBindImageTexture(0, state->texture_id, 0, GL_FALSE, 0, GL_WRITE_ONLY, state->texture_format);
+
+    /* NOTE: only ever accessed as an image by the compute shader, the immutable storage cannot be resized so it is replaced */
+    if (resized)
+    {
+        if (state->accum_texture_id) { glDeleteTextures(1, &state->accum_texture_id); }
+        glGenTextures(1, &state->accum_texture_id);
+        glBindTexture(GL_TEXTURE_2D, state->accum_texture_id);
+        glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA32F, width, height);
+    }
+    glBindImageTexture(1, state->accum_texture_id, 0, GL_FALSE, 0, GL_READ_WRITE, GL_RGBA32F);
+    glBindTexture(GL_TEXTURE_2D, state->texture_id);
+
+    #if WAVEFRONT_ENABLE
+    /* NOTE: the queue entries hold the two extend queues and the hits, see queue_item() in compute.glsl */
+    upload_ssbo(&state->ssbo[SSBO_PATHS],       SSBO_PATHS,       NULL, sizeof(path_t) * width * height);
+    upload_ssbo(&state->ssbo[SSBO_QUEUE_ITEMS], SSBO_QUEUE_ITEMS, NULL, sizeof(uint)   * width * height * 3);
+    #endif
+    upload_ssbo(&state->ssbo[SSBO_TILES], SSBO_TILES, NULL, sizeof(queue_t) + sizeof(tile_t) * TILE_COUNT(width, height));
+
+    scale_resize(&state->scale, width, height);
+    slice_reset(&state->slice);
+    progressive_reset(&state->progressive);
+    state->image_valid = 0;
+    if (state->record.active)
+    {
+        record_stop(&state->record);
+        record_start(&state->record, state->config.record_path, state->record.frame, width, height);
     }
+}
+
+void GLAPIENTRY gl_debug_callback(GLenum source, GLenum type, GLuint id, GLenum severity, GLsizei length, const GLchar* message, const void* userParam) { fprintf(stderr, "%s\n", message); }
+EXPORT int on_load(state_t* state, const config_t* config)
+{
+    migrate_state(state);
+    state->config = *config;
 
-    /* init glew */
+    /* build the scene, it is only kept around until it is uploaded */
+    scene_t scene = {0};
+    if (!scene_load(&scene)) { return 0; }
+
+    /* init glew, NOTE: again on every load, glew is loaded and unloaded with the dll (the exe does not link it) */
     {
         glewExperimental = GL_TRUE;
-        if (glewInit() != GLEW_OK) { printf("Failed to initialize glew.\n"); }
+        GLenum result = glewInit();
+        #ifdef GLEW_ERROR_NO_GLX_DISPLAY
+        /* NOTE: the gl functions are loaded before glew gives up on glx, which an egl context does not have */
+        if (result == GLEW_ERROR_NO_GLX_DISPLAY && config->headless) { result = GLEW_OK; }
+        #endif
+        if (result != GLEW_OK) { printf("Failed to initialize glew.\n"); }
+
+        /* NOTE: both extensions have the same enums and the same function */
+        state->parallel_compile = GLEW_KHR_parallel_shader_compile || GLEW_ARB_parallel_shader_compile;
+        if (GLEW_KHR_parallel_shader_compile)      { glMaxShaderCompilerThreadsKHR(0xFFFFFFFF); }
+        else if (GLEW_ARB_parallel_shader_compile) { glMaxShaderCompilerThreadsARB(0xFFFFFFFF); }
 
         const GLubyte* renderer = glGetString( GL_RENDERER );
         const GLubyte* version  = glGetString( GL_VERSION );
@@ -135,7 +732,7 @@ EXPORT int on_load(state_t* state)
         //exit(0);
     }
 
-    /* enable debugging abilities */
+    /* enable debugging abilities, NOTE: the callback of the previous load went away with its dll */
     {
         glEnable(GL_DEBUG_OUTPUT_SYNCHRONOUS);
         glDebugMessageCallback(gl_debug_callback, NULL);
@@ -149,14 +746,17 @@ EXPORT int on_load(state_t* state)
         assert(glGetError() == GL_NO_ERROR);
 
         //glEnable(GL_TEXTURE_2D); // NOTE: causes error...
-        glGenTextures(1, texture_id);
+        if (!*texture_id) { glGenTextures(1, texture_id); } /* NOTE: kept across hot reloads */
 
         glActiveTexture(GL_TEXTURE0);
         glBindTexture(GL_TEXTURE_2D, *texture_id);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        /* NOTE: bilinear for the blit of a rect smaller than the window, see scale.h */
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 
-        glTexImage2D(GL_TEXTURE_2D, 0, *texture_format, WINDOW_WIDTH, WINDOW_HEIGHT, 0, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+        /* NOTE: the storage of both textures is allocated by resize_images() at the end of on_load() */
         //glBindTexture(GL_TEXTURE_2D, 0);
     }
 
@@ -168,10 +768,11 @@ EXPORT int on_load(state_t* state)
     {
         assert(glGetError() == GL_NO_ERROR);
 
-        glGenVertexArrays(1, texture_vao);
+        /* NOTE: kept across hot reloads, only the (tiny) vertex data and format are specified again */
+        if (!*texture_vao) { glGenVertexArrays(1, texture_vao); }
         glBindVertexArray(*texture_vao);
 
-        glGenBuffers(1, texture_vbo);
+        if (!*texture_vbo) { glGenBuffers(1, texture_vbo); }
         glBindBuffer(GL_ARRAY_BUFFER, *texture_vbo);
         glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
 
@@ -186,6 +787,8 @@ EXPORT int on_load(state_t* state)
     {
         assert(glGetError() == GL_NO_ERROR);
 
+        /* NOTE: the blit shaders of a hot reload replace the ones of the previous load */
+        if (*vertex_shader_id) { glDeleteShader(*vertex_shader_id); }
         *vertex_shader_id = glCreateShader(GL_VERTEX_SHADER);
         const char* vs_source = SHADER_VERSION_STRING S(
                                   layout(location=0) in vec4 pos;
@@ -214,13 +817,16 @@ EXPORT int on_load(state_t* state)
     {
         assert(glGetError() == GL_NO_ERROR);
 
+        if (*frag_shader_id) { glDeleteShader(*frag_shader_id); }
         *frag_shader_id = glCreateShader(GL_FRAGMENT_SHADER);
         const char* fs_source = SHADER_VERSION_STRING S(
                                   in vec2 o_tex_coord;
                                   out vec4 color;
                                   uniform sampler2D u_texture;
+                                  uniform vec2 scale; /* traced rect of the texture, see scale.h */
                                   void main(void) {
-                                  color = texture(u_texture, o_tex_coord);
+                                  /* NOTE: clamped to the centers of the last texels, the filter must not reach past the rect */
+                                  color = texture(u_texture, min(o_tex_coord * scale, scale - 0.5 / vec2(textureSize(u_texture, 0))));
                                 });
         glShaderSource(*frag_shader_id, 1, &fs_source, NULL);
         glCompileShader(*frag_shader_id);
@@ -241,6 +847,7 @@ EXPORT int on_load(state_t* state)
     {
         assert(glGetError() == GL_NO_ERROR);
 
+        if (*shader_program_id) { glDeleteProgram(*shader_program_id); }
         *shader_program_id = glCreateProgram();
         glAttachShader(*shader_program_id, *vertex_shader_id);
         glAttachShader(*shader_program_id, *frag_shader_id);
@@ -257,254 +864,92 @@ EXPORT int on_load(state_t* state)
         }
     }
 
-    /* create compute shader & program */
-    unsigned int* compute_shader_id = &state->compute_shader_id;
-    unsigned int* cs_program_id     = &state->cs_program_id;
+    /* pick the tightest variant for the scene and the options */
+    program_build_t* build = &state->program_build;
     {
-        assert(glGetError() == GL_NO_ERROR);
+        discard_programs(state); /* NOTE: of a hot reload that did not finish compiling */
 
-        glActiveTexture(GL_TEXTURE0 + 0);
-        glBindTexture(GL_TEXTURE_2D, state->texture_id);
-        glBindImageTexture(0, state->texture_id, 0, GL_FALSE, 0, GL_WRITE_ONLY, state->texture_format);
+        uint light_count = scene.light_count;
+        if (light_count > MAX_LIGHTS) { printf("Only the first %i of %u lights are used\n", MAX_LIGHTS, scene.light_count); light_count = MAX_LIGHTS; }
 
+        variant_t* variant    = &build->variant;
+        variant->bounces      = (config->bounces > 0 && config->bounces < MAX_BOUNCES) ? config->bounces : MAX_BOUNCES;
+        variant->lights       = light_count;
+        variant->faces        = scene.face_count > 0;
+        variant->spheres      = scene.sphere_count > 0;
+        variant->orthographic = config->orthographic;
+    }
 
+    /* create compute programs */
+    {
         assert(glGetError() == GL_NO_ERROR);
 
-        *compute_shader_id = glCreateShader(GL_COMPUTE_SHADER);
-        const char* cs_source =
+        /* NOTE: while compute.glsl is watched, the file may be newer than the dll */
+        if (config->watch_shader && !state->shader_watch.active) { shader_watch_start(&state->shader_watch); }
+        char*       disk_source = state->shader_watch.active ? load_shader_source() : NULL;
+        const char* cs_source   = disk_source ? disk_source :
                                 #include "compute.glsl"
                                 ;
-        glShaderSource(*compute_shader_id, 1, &cs_source, NULL);
-        glCompileShader(*compute_shader_id);
+        uint compiling = build_programs(state, cs_source);
+        free(disk_source);
+
+        state->face_count        = scene.face_count;
+        state->sphere_count      = scene.sphere_count;
+        state->triangle_bvh_root = scene.triangle_bvh_root;
+        state->sphere_bvh_root   = scene.sphere_bvh_root;
+
+        /*
+         * NOTE: after a hot reload draw() keeps going with the previous programs until these are
+         * done, see poll_programs(). Those get the uniforms of the new scene, whose buffers are
+         * uploaded below. Programs of another variant cannot trace the new scene at all (the
+         * counts of its lights, faces and spheres are constants of the programs), so then the
+         * new ones are waited for.
+         */
+        int first = !state->cs_program_id[PASS_COMPACT];
+        int wait  = first || memcmp(&build->variant, &state->variant, sizeof(variant_t)) != 0;
+        if (compiling && !wait) { printf("Compiling %u programs in the background\n", compiling); }
+        if ((wait || !compiling) && !poll_programs(state, 1) && first) { return 0; }
+        set_scene_uniforms(state, state->cs_program_id);
 
         assert(glGetError() == GL_NO_ERROR);
+    }
 
-        /* print any compile errors */
-        int success;
-        char infoLog[512];
-        glGetShaderiv(*compute_shader_id, GL_COMPILE_STATUS, &success);
-        if(!success)
-        {
-            glGetShaderInfoLog(*compute_shader_id, 512, NULL, infoLog);
-            printf("%s\n", cs_source);
-            printf("Compute shader compilation failed: %s\n", infoLog);
-            return 0;
-        };
 
-        *cs_program_id = glCreateProgram();
-        glAttachShader(*cs_program_id, *compute_shader_id);
-        glLinkProgram(*cs_program_id);
-        glDeleteShader(*compute_shader_id);
+    /* upload buffers to compute shader, NOTE: only the ones that changed since the previous load */
+    {
+        size_t uploaded = 0;
+        uploaded += upload_ssbo(&state->ssbo[SSBO_VERTICES],  SSBO_VERTICES,  scene.vertices,  sizeof(vec4)       * scene.vertex_count);
+        uploaded += upload_ssbo(&state->ssbo[SSBO_FACES],     SSBO_FACES,     scene.faces,     sizeof(face_t)     * scene.face_count);
+        uploaded += upload_ssbo(&state->ssbo[SSBO_SPHERES],   SSBO_SPHERES,   scene.spheres,   sizeof(sphere_t)   * scene.sphere_count);
+        uploaded += upload_ssbo(&state->ssbo[SSBO_MATERIALS], SSBO_MATERIALS, scene.materials, sizeof(material_t) * scene.material_count);
+        uploaded += upload_ssbo(&state->ssbo[SSBO_LIGHTS],    SSBO_LIGHTS,    scene.lights,    sizeof(light_t)    * scene.light_count);
+        uploaded += upload_ssbo(&state->ssbo[SSBO_BVH],       SSBO_BVH,       scene.nodes,     sizeof(bvh_node_t) * scene.node_count);
+        uploaded += upload_ssbo(&state->ssbo[SSBO_TRIANGLES], SSBO_TRIANGLES, scene.triangles, sizeof(triangle_t) * scene.face_count);
+
+        #if WAVEFRONT_ENABLE
+        upload_ssbo(&state->ssbo[SSBO_QUEUES],      SSBO_QUEUES,      NULL, sizeof(queue_t) * QUEUE_COUNT);
+        #endif
 
-        /* print any linking errors */
-        glGetProgramiv(*cs_program_id, GL_LINK_STATUS, &success);
-        if(!success)
-        {
-            glGetProgramInfoLog(*cs_program_id, 512, NULL, infoLog);
-            printf("Shader linking failed: %s\n", infoLog);
-            return 0;
-        }
+        /* NOTE: the buffers with one entry per pixel or tile are allocated by resize_images() */
+        /* NOTE: written by the shaders, so it is cleared instead of uploaded (upload_ssbo() leaves it bound) */
+        upload_ssbo(&state->ssbo[SSBO_NOISE], SSBO_NOISE, NULL, sizeof(uint) * PROGRESSIVE_SLOT_COUNT);
+        glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, NULL);
 
-        glUseProgram(*cs_program_id);
+        printf("Uploaded %.1f KiB of scene data\n", uploaded / 1024.0);
 
-        assert(glGetError() == GL_NO_ERROR);
+        scene_free(&scene);
     }
 
-    /* construct scene */
-    {
-        memset(prim_buf, 0, sizeof(prim_buf)); // NOTE needs zero initialization
-
-        // box front
-        int i = 0;
-        prim_buf[i].type = PRIMITIVE_TYPE_TRIANGLE;
-        prim_buf[i].t = (triangle_t){{{{ 3.0, 5.0, -1}}}, 0,
-                                     {{{ 0.0, 5.0, -1}}}, 0,
-                                     {{{ 0.0, 2.0, -1}}}, 0,};
-        prim_buf[i].mat.type  = MATERIAL_TYPE_DIFFUSE;
-        prim_buf[i].mat.color = (vec4){{{0,0,1,1}}};
-
-        i++;
-        prim_buf[i].type = PRIMITIVE_TYPE_TRIANGLE;
-        prim_buf[i].t = (triangle_t){{{{ 3.0, 5.0, -1}}}, 0,
-                                     {{{ 0.0, 2.0, -1}}}, 0,
-                                     {{{ 3.0, 2.0, -1}}}, 0,};
-        prim_buf[i].mat.type  = MATERIAL_TYPE_DIFFUSE;
-        prim_buf[i].mat.color = (vec4){{{0,0,1,1}}};
-
-        // box top
-        i++;
-        prim_buf[i].type = PRIMITIVE_TYPE_TRIANGLE;
-        prim_buf[i].t = (triangle_t){{{{ 0.0, 2.0, -1}}}, 0,
-                                     {{{ 0.0, 2.0,  3}}}, 0,
-                                     {{{ 3.0, 2.0, -1}}}, 0,};
-        prim_buf[i].mat.type  = MATERIAL_TYPE_DIFFUSE;
-        prim_buf[i].mat.color = (vec4){{{0,0,1,1}}};
-        
-        i++;
-        prim_buf[i].type = PRIMITIVE_TYPE_TRIANGLE;
-        prim_buf[i].t = (triangle_t){{{{ 0.0, 2.0,  3}}}, 0,
-                                     {{{ 3.0, 2.0,  3}}}, 0,
-                                     {{{ 3.0, 2.0, -1}}}, 0,};
-        prim_buf[i].mat.type  = MATERIAL_TYPE_DIFFUSE;
-        prim_buf[i].mat.color = (vec4){{{0,0,1,1}}};
-
-        // box right side
-        i++;
-        prim_buf[i].type = PRIMITIVE_TYPE_TRIANGLE;
-        prim_buf[i].t = (triangle_t){{{{ 0.0, 5.0, -1}}}, 0,
-                                     {{{ 0.0, 5.0,  3}}}, 0,
-                                     {{{ 0.0, 2.0,  3}}}, 0,};
-        prim_buf[i].mat.type  = MATERIAL_TYPE_DIFFUSE;
-        prim_buf[i].mat.color = (vec4){{{0,0,1,1}}};
-
-        i++;
-        prim_buf[i].type = PRIMITIVE_TYPE_TRIANGLE;
-        prim_buf[i].t = (triangle_t){{{{ 0.0, 2.0,  3}}}, 0,
-                                     {{{ 0.0, 2.0, -1}}}, 0,
-                                     {{{ 0.0, 5.0, -1}}}, 0,};
-        prim_buf[i].mat.type  = MATERIAL_TYPE_DIFFUSE;
-        prim_buf[i].mat.color = (vec4){{{0,0,1,1}}};
-
-        i++;
-        prim_buf[i].type = PRIMITIVE_TYPE_SPHERE;
-        prim_buf[i].s = (sphere_t){{{{  2, 0.5, -3}}}, 1.0};
-        prim_buf[i].mat.type  = MATERIAL_TYPE_SPECULAR;
-        prim_buf[i].mat.color = (vec4){{{1,1,0,1}}};
-        prim_buf[i].mat.spec  = 0.5f;
-
-        i++;
-        prim_buf[i].type = PRIMITIVE_TYPE_SPHERE;
-        prim_buf[i].s = (sphere_t){{{{ -1, -2, 2}}}, 1.0};
-        prim_buf[i].mat.type  = MATERIAL_TYPE_SPECULAR;
-        prim_buf[i].mat.color = (vec4){{{1,0,1,1}}};
-        prim_buf[i].mat.spec  = 0.9f;
-
-        // back wall
-        i++;
-        prim_buf[i].type = PRIMITIVE_TYPE_TRIANGLE;
-        prim_buf[i].t = (triangle_t){{{{   5, -5, 5}}}, 0,
-                                     {{{  -5, -5, 5}}}, 0,
-                                     {{{  -5,  5, 5}}}, 0,};
-        prim_buf[i].mat.type  = MATERIAL_TYPE_DIFFUSE;
-        prim_buf[i].mat.color = (vec4){{{0.3,0.2,1,1}}};
-
-        i++;
-        prim_buf[i].type = PRIMITIVE_TYPE_TRIANGLE;
-        prim_buf[i].t = (triangle_t){{{{   5,  5, 5}}}, 0,
-                                     {{{   5, -5, 5}}}, 0,
-                                     {{{  -5,  5, 5}}}, 0,};
-        prim_buf[i].mat.type  = MATERIAL_TYPE_DIFFUSE;
-        prim_buf[i].mat.color = (vec4){{{0.3,0.2,1,1}}};
-
-        // left wall
-        i++;
-        prim_buf[i].type = PRIMITIVE_TYPE_TRIANGLE;
-        prim_buf[i].t = (triangle_t){{{{5, -5, -5}}}, 0,
-                                     {{{5,  5, -5}}}, 0,
-                                     {{{5, -5,  5}}}, 0};
-        prim_buf[i].mat.type = MATERIAL_TYPE_DIFFUSE;
-        prim_buf[i].mat.color = (vec4){{{1.0, 0.0, 0, 1}}};
-
-        i++;
-        prim_buf[i].type = PRIMITIVE_TYPE_TRIANGLE;
-        prim_buf[i].t = (triangle_t){{{{5,  5, 5}}}, 0,
-                                     {{{5, -5, 5}}}, 0,
-                                     {{{5,  5,-5}}}, 0};
-        prim_buf[i].mat.type = MATERIAL_TYPE_DIFFUSE;
-        prim_buf[i].mat.color = (vec4){{{1.0, 0.0, 0, 1}}};
-
-        // right wall
-        i++;
-        prim_buf[i].type = PRIMITIVE_TYPE_TRIANGLE;
-        prim_buf[i].t = (triangle_t){{{{-5, -5,  5}}}, 0,
-                                     {{{-5,  5,  5}}}, 0,
-                                     {{{-5, -5, -5}}}, 0};
-        prim_buf[i].mat.type = MATERIAL_TYPE_DIFFUSE;
-        prim_buf[i].mat.color = (vec4){{{0.0, 1.0, 0.0, 1}}};
-
-        i++;
-        prim_buf[i].type = PRIMITIVE_TYPE_TRIANGLE;
-        prim_buf[i].t = (triangle_t){{{{-5,  5,  5}}}, 0,
-                                     {{{-5,  5, -5}}}, 0,
-                                     {{{-5, -5, -5}}}, 0};
-        prim_buf[i].mat.type = MATERIAL_TYPE_DIFFUSE;
-        prim_buf[i].mat.color = (vec4){{{0.0, 1.0, 0.0, 1}}};
-
-        // ceiling
-        i++;
-        prim_buf[i].type = PRIMITIVE_TYPE_TRIANGLE;
-        prim_buf[i].t = (triangle_t){{{{-5, -5, -5}}}, 0,
-                                     {{{ 5, -5, -5 }}}, 0,
-                                     {{{-5, -5, 5 }}}, 0};
-        prim_buf[i].mat.type = MATERIAL_TYPE_DIFFUSE;
-        prim_buf[i].mat.color = (vec4){{{0.3, 0.3, 0.3, 1}}};
-
-        i++;
-        prim_buf[i].type = PRIMITIVE_TYPE_TRIANGLE;
-        prim_buf[i].t = (triangle_t){{{{ 5, -5,  5}}}, 0,
-                                     {{{-5, -5,  5}}}, 0,
-                                     {{{ 5, -5, -5}}}, 0};
-        prim_buf[i].mat.type = MATERIAL_TYPE_DIFFUSE;
-        prim_buf[i].mat.color = (vec4){{{0.3, 0.3, 0.3, 1}}};
-
-        // floor
-        i++;
-        prim_buf[i].type = PRIMITIVE_TYPE_TRIANGLE;
-        prim_buf[i].t = (triangle_t){{{{-5,  5, -5}}}, 0,
-                                     {{{ 5,  5, -5}}}, 0,
-                                     {{{-5,  5,  5}}}, 0};
-        prim_buf[i].mat.type = MATERIAL_TYPE_DIFFUSE;
-        prim_buf[i].mat.color = (vec4){{{0.3, 0.3, 0.3, 1}}};
-
-        i++;
-        prim_buf[i].type = PRIMITIVE_TYPE_TRIANGLE;
-        prim_buf[i].t = (triangle_t){{{{ 5, 5,  5}}}, 0,
-                                     {{{-5, 5,  5}}}, 0,
-                                     {{{ 5, 5, -5}}}, 0};
-        prim_buf[i].mat.type = MATERIAL_TYPE_DIFFUSE;
-        prim_buf[i].mat.color = (vec4){{{0.3, 0.3, 0.3, 1}}};
-
-        // "infinite" floor plane
-        i++;
-        prim_buf[i].type = PRIMITIVE_TYPE_TRIANGLE;
-        prim_buf[i].t = (triangle_t){{{{-5000,  5.1, -5000}}}, 0,
-                                     {{{ 5000,  5.1, -5000}}}, 0,
-                                     {{{-5000,  5.1,  5000}}}, 0};
-        prim_buf[i].mat.type = MATERIAL_TYPE_DIFFUSE;
-        prim_buf[i].mat.color = (vec4){{{0.5, 0.8, 0.3, 1}}};
-
-        i++;
-        prim_buf[i].type = PRIMITIVE_TYPE_TRIANGLE;
-        prim_buf[i].t = (triangle_t){{{{ 5000,  5.1,  5000}}}, 0,
-                                     {{{-5000,  5.1,  5000}}}, 0,
-                                     {{{ 5000,  5.1, -5000}}}, 0};
-        prim_buf[i].mat.type = MATERIAL_TYPE_DIFFUSE;
-        prim_buf[i].mat.color = (vec4){{{0.5, 0.8, 0.3, 1}}};
-    }
-
-    {
-        int i = 0;
-        light_buf[i].type           = LIGHT_TYPE_POINT;
-        light_buf[i].p.intensity    = 0.40f;
-        light_buf[i].pos            = (vec3){{{0.8, -4.9, -3}}}; // above sphere
-        //light_buf[i].pos            = (vec3){{{2.5, -4.9, 2.5}}};
-        light_buf[i].color          = (vec4){{{1,1,0.7,1}}};
-    }
-
-    /* upload buffers to compute shader */
-    {
-        GLuint ssbo_prims; // shader storage buffer object
-        glGenBuffers(1, &ssbo_prims);
-        glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssbo_prims);
-        glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(primitive_t) * PRIMITIVE_COUNT, prim_buf, GL_STATIC_DRAW);
-        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, ssbo_prims);
-
-        GLuint ssbo_lights;
-        glGenBuffers(1, &ssbo_lights);
-        glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssbo_lights);
-        glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(light_t) * LIGHT_COUNT, light_buf, GL_STATIC_DRAW);
-        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, ssbo_lights);
-    }
+    /* NOTE: the benchmark and the recording should see every pixel of every frame */
+    if (config->slice_budget_ms > 0 && (config->bench_path || config->record_path)) { printf("No time slicing while benchmarking or recording\n"); }
+    else if (config->slice_budget_ms > 0 && !state->slice.active) { slice_start(&state->slice, config->slice_budget_ms); }
+
+    /* NOTE: scale.h measures whole images, a slice is only a part of one */
+    if (config->frame_budget_ms > 0 && (config->bench_path || config->record_path || state->slice.active)) { printf("No dynamic resolution while benchmarking, recording or time slicing\n"); }
+    else if (config->frame_budget_ms > 0 && !state->scale.active) { scale_start(&state->scale, config->frame_budget_ms); }
+
+    /* NOTE: a hot reload keeps the size the window was resized to, the exe passes it in config */
+    resize_images(state, config->width > 0 ? config->width : WINDOW_WIDTH, config->height > 0 ? config->height : WINDOW_HEIGHT);
 
     if (!state->initialized)
     {
@@ -514,6 +959,19 @@ EXPORT int on_load(state_t* state)
         state->initialized = 1;
     }
 
+    /* NOTE: on_unload() stopped the recording before a hot reload, continue with the next frame number */
+    if (config->record_path) { record_start(&state->record, config->record_path, state->record.frame, state->width, state->height); }
+
+    /* NOTE: the benchmark keeps its samples across hot reloads and only runs once */
+    if (config->bench_path && !state->bench.active && state->bench.frame == 0) { bench_start(&state->bench, config->bench_path); }
+    if (config->profile_path && !state->profile.active) { profile_start(&state->profile, config->profile_path); }
+
+    /* NOTE: starts over after a hot reload, the scene or the shader may have changed. Every frame of a benchmark has to dispatch. */
+    progressive_reset(&state->progressive);
+    state->image_valid = 0;
+    state->progressive.active = 0;
+    if (config->progressive_samples > 0 && !config->bench_path) { progressive_start(&state->progressive, config->progressive_samples, state->ssbo[SSBO_NOISE].id); }
+
     return 1;
 }
 
@@ -525,6 +983,9 @@ vec4 vec4_cross(const vec4 v1, vec4 v2) { vec4 ret = {{{v1.y * v2.z - v1.z * v2.
 #include <math.h> // for fmod, sqrt, atan2, cos, sin, M_PI, ...
 EXPORT void update(state_t* state, char input, double delta_cursor_x, double delta_cursor_y)
 {
+    /* NOTE: the rotation below changes the last bits of the direction even without input, which would restart the progressive image */
+    if (input == ' ' && delta_cursor_x == 0 && delta_cursor_y == 0) { return; }
+
     vec4* dir = &state->camera.dir;
     /* rotate_camera */
     {
@@ -562,53 +1023,498 @@ EXPORT void update(state_t* state, char input, double delta_cursor_x, double del
     }
 }
 
-EXPORT void draw(state_t* state)
+/*
+ * Builds the list of the tiles that need another sample (see compact() in compute.glsl), the
+ * passes that start paths are dispatched over it. restart forgets the samples of all tiles.
+ */
+void compact_tiles(state_t* state, int restart)
 {
-    glClear(GL_COLOR_BUFFER_BIT);
-    glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, state->ssbo[SSBO_TILES].id);
+    if (restart) { glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, NULL); }
+    queue_t tile_queue = { 0, 0, 1, 0 };
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(queue_t), &tile_queue);
+
+    glUseProgram(state->cs_program_id[PASS_COMPACT]);
+    glDispatchCompute((TILE_COUNT(state->scale.width, state->scale.height) + WAVEFRONT_GROUP_SIZE - 1) / WAVEFRONT_GROUP_SIZE, 1, 1);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT);
+}
 
-    glUseProgram(state->cs_program_id);
+/* dispatches the program over the list of compact_tiles(), over all of it (indirect) or over the slice of slice.h */
+void dispatch_tiles(state_t* state, unsigned int program_id)
+{
+    glUseProgram(program_id);
+    if (state->slice.active)
+    {
+        glUniform1ui(glGetUniformLocation(program_id, "tile_offset"), state->slice.offset);
+        glDispatchCompute(state->slice.tiles, 1, 1);
+    }
+    else
+    {
+        glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, state->ssbo[SSBO_TILES].id);
+        glDispatchComputeIndirect(0);
+    }
+}
 
-    /* upload uniforms */
+/*
+ * Dispatches the wavefront passes of compute.glsl, see there. The passes that work through a
+ * queue get their work group count from the queue (glDispatchComputeIndirect), so the cpu never
+ * waits for the number of paths that are still alive.
+ */
+void dispatch_wavefront(state_t* state)
+{
+    /* reset the queues of all bounces, the shadow pass runs once per light */
+    queue_t queues[QUEUE_COUNT];
+    for (int n = 0; n < QUEUE_COUNT; n++)
     {
-        camera_t* camera                = &state->camera;
-        unsigned int* cs_program_id     = &state->cs_program_id;
-        glUniform4f(glGetUniformLocation(*cs_program_id, "camera.pos"), camera->pos.x, camera->pos.y, camera->pos.z, camera->pos.w);
-        glUniform4f(glGetUniformLocation(*cs_program_id, "camera.dir"), camera->dir.x, camera->dir.y, camera->dir.z, camera->dir.w);
+        queue_t queue = { 0, 0, (n % QUEUE_KINDS == QUEUE_SHADOW) ? state->variant.lights : 1, 0 };
+        queues[n]     = queue;
     }
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, state->ssbo[SSBO_QUEUES].id);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(queues), queues);
+
+    /* NOTE: generate and accumulate run over the tiles of compact_tiles(), the other passes over their queue */
+    dispatch_tiles(state, state->cs_program_id[PASS_GENERATE]);
+    glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, state->ssbo[SSBO_QUEUES].id);
+
+    /* NOTE: indexed by the kind of queue the pass works through */
+    static const int queue_passes[QUEUE_KINDS] = { PASS_EXTEND, PASS_SHADOW, PASS_SHADE };
+    for (uint bounce = 0; bounce < state->variant.bounces; bounce++)
+    {
+        for (int kind = 0; kind < QUEUE_KINDS; kind++)
+        {
+            unsigned int program_id = state->cs_program_id[queue_passes[kind]];
+            glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT);
+            glUseProgram(program_id);
+            glUniform1ui(glGetUniformLocation(program_id, "bounce"), bounce);
+            glDispatchComputeIndirect((GLintptr) ((bounce * QUEUE_KINDS + kind) * sizeof(queue_t)));
+        }
+    }
+
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    dispatch_tiles(state, state->cs_program_id[PASS_ACCUMULATE]);
+}
+
+/* traces the tiles of the list of compact_tiles(), all of them or the next slice, returns 1 once the image is done */
+int trace_tiles(state_t* state)
+{
+    slice_t* slice = &state->slice;
+    if (slice->active) { slice_begin(slice); }
+    #if WAVEFRONT_ENABLE
+    dispatch_wavefront(state);
+    #else
+    dispatch_tiles(state, state->cs_program_id[PASS_MEGAKERNEL]);
+    #endif
+    return !slice->active || slice_end(slice);
+}
+
+/* returns 1 while the image still changes without input (progressive samples, slices, programs being compiled), see PACING_ON_DEMAND */
+EXPORT int draw(state_t* state)
+{
+    profile_begin(&state->profile);
+
+    /* NOTE: the programs of a hot reload are swapped in once they are compiled */
+    if (shader_watch_changed(&state->shader_watch)) { reload_shader(state); }
+    poll_programs(state, 0);
+
+    /* NOTE: there is no default framebuffer without a window */
+    if (!state->config.headless)
+    {
+        glClear(GL_COLOR_BUFFER_BIT);
+        glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+    }
+    profile_stage(&state->profile, PROFILE_STAGE_CLEAR);
+
+    /*
+     * NOTE: once the image is done (converged when progressive), the texture is only shown again
+     * until the camera moves. The scene, the programs and the size of the images only change in
+     * on_load(), poll_programs() and resize_images(), which start the image over. The benchmark,
+     * the profile and the frame times of --headless (and of bench.sh) measure the dispatch, so
+     * they trace every frame.
+     */
+    progressive_t* progressive = &state->progressive;
+    int            measured    = state->bench.active || state->profile.active || state->config.headless;
+    #ifdef BENCH_TRIANGLE_COUNT
+    measured = 1;
+    #endif
+    int            stale       = !state->image_valid || measured || memcmp(&state->camera, &state->image_camera, sizeof(camera_t)) != 0;
+    if (slice_pending(&state->slice, &state->camera))
+    {
+        /* NOTE: the next slice of the image in progress, its uniforms are still set */
+        int done = trace_tiles(state);
+        if (done && progressive->active) { progressive_end(progressive); }
+        state->image_valid = done;
+    }
+    else if (progressive->active ? progressive_begin(progressive, &state->camera) : stale)
+    {
+        /* NOTE: the traced rect only changes when the image starts over anyway */
+        scale_t* scale   = &state->scale;
+        int      rescale = scale->active && (!progressive->active || progressive->sample_count == 0);
+        if (rescale) { scale_update(scale, state->width, state->height); }
+
+        /* upload uniforms, NOTE: every program gets all of them, the ones it does not use are ignored (location -1) */
+        for (int pass = 0; pass < PASS_COUNT; pass++)
+        {
+            camera_t*    camera     = &state->camera;
+            unsigned int program_id = state->cs_program_id[pass];
+            if (!program_id) { continue; }
+
+            glUseProgram(program_id);
+            glUniform4f(glGetUniformLocation(program_id, "camera.pos"), camera->pos.x, camera->pos.y, camera->pos.z, camera->pos.w);
+            glUniform4f(glGetUniformLocation(program_id, "camera.dir"), camera->dir.x, camera->dir.y, camera->dir.z, camera->dir.w);
+            glUniform1ui(glGetUniformLocation(program_id, "noise_slot"), progressive->slot);
+            glUniform2ui(glGetUniformLocation(program_id, "resolution"), scale->width, scale->height);
+        }
+
+        /* NOTE: without progressive rendering every frame is the first sample */
+        if (state->bench.active) { bench_begin(&state->bench); }
+        if (rescale) { scale_begin(scale); }
+        compact_tiles(state, !progressive->active || progressive->sample_count == 0);
+        if (state->slice.active) { slice_image(&state->slice, &state->camera, state->ssbo[SSBO_TILES].id, TILE_COUNT(scale->width, scale->height)); }
+        int done = trace_tiles(state);
+        if (rescale) { scale_end(scale); }
+        if (state->bench.active) { bench_end(&state->bench, state->config.frame_count, state->width, state->height); }
+        if (done && progressive->active) { progressive_end(progressive); }
+        state->image_valid  = done;
+        state->image_camera = state->camera;
+    }
+    profile_stage(&state->profile, PROFILE_STAGE_DISPATCH);
 
-    glDispatchCompute(WINDOW_WIDTH/WORK_GROUP_SIZE_X, WINDOW_HEIGHT/WORK_GROUP_SIZE_Y, 1);
     glMemoryBarrier(GL_ALL_BARRIER_BITS);
+    profile_stage(&state->profile, PROFILE_STAGE_BARRIER);
+
+    if (state->record.active) { record_frame(&state->record, state->texture_id); }
+    profile_stage(&state->profile, PROFILE_STAGE_RECORD);
 
     /* draw the texture */
+    if (!state->config.headless)
     {
         glUseProgram(state->shader_program_id);
+        glUniform2f(glGetUniformLocation(state->shader_program_id, "scale"), (float) state->scale.width / state->width, (float) state->scale.height / state->height);
         glBindBuffer(GL_ARRAY_BUFFER, state->texture_vbo);
         glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
     }
+    profile_stage(&state->profile, PROFILE_STAGE_BLIT);
+
+    profile_end(&state->profile);
+    return state->program_build.active || slice_pending(&state->slice, &state->camera) || (progressive->active && !progressive->converged);
+}
+
+/* called by the exe when the framebuffer of the window changes its size */
+EXPORT void resize(state_t* state, int width, int height)
+{
+    state->config.width  = width;
+    state->config.height = height;
+    resize_images(state, width, height);
+    printf("Resized to %ix%i\n", width, height);
+}
+
+/* called before the dll is closed (hot reload or exit), stops everything that runs code of the dll */
+EXPORT void on_unload(state_t* state)
+{
+    record_stop(&state->record);
+    profile_flush(&state->profile);
 }
 #endif /* COMPILE_DLL */
 
 
 #ifdef COMPILE_EXE
+#define SHADER_CACHE_PATH "shader_cache" // default of --shader-cache, see binary_cache.h
+
 #ifndef COMPILE_DLL
 #include <dlfcn.h>
-#include <sys/stat.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #define DLL_FILENAME "./code.dll"
-static void*  dll_handle;
-static time_t dll_last_mod;
+#define DLL_RETRY_DELAY_MIN  0.01 // s, the delay doubles after every failed dlopen of a changed dll
+#define DLL_RETRY_DELAY_MAX  1.0
+#define DLL_RETRY_COUNT      10   // failed dlopen after which the dll is only tried again once it changes again
+static void*      dll_handle;
+static atomic_int dll_changed; /* set by dll_watch() */
+static int        dll_pending; /* changed, but not loaded yet */
+static int        dll_retry_count;
+static double     dll_retry_delay;
+static double     dll_retry_time; /* of the next dlopen after a failed one */
 typedef struct state_t state_t;
-static int  (*on_load)(state_t*);
+static int  (*on_load)(state_t*, const config_t*);
 static void (*update)(state_t*, char, double, double);
-static void (*draw)(state_t*);
+static int  (*draw)(state_t*);
+static void (*resize)(state_t*, int, int);
+static void (*on_unload)(state_t*);
+
+#if defined(__linux__)
+#include <sys/inotify.h>
+#include <unistd.h> // for read
+
+/*
+ * Thread that sleeps until the dll is written and wakes the main loop, which then reloads it.
+ * NOTE: IN_CLOSE_WRITE comes once the linker is done with the file, a new file that is renamed
+ * over the dll comes as IN_MOVED_TO.
+ */
+static void* dll_watch(void* arg)
+{
+    int fd = inotify_init1(IN_CLOEXEC);
+    if (fd < 0 || inotify_add_watch(fd, ".", IN_CLOSE_WRITE | IN_MOVED_TO) < 0) { printf("Could not watch %s, no hot reload\n", DLL_FILENAME); return NULL; }
+
+    char events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    for (ssize_t length; (length = read(fd, events, sizeof(events))) > 0; )
+    {
+        for (char* event = events; event < events + length; event += sizeof(struct inotify_event) + ((struct inotify_event*) event)->len)
+        {
+            const struct inotify_event* e = (const struct inotify_event*) event;
+            if (e->len > 0 && strcmp(e->name, strrchr(DLL_FILENAME, '/') + 1) == 0)
+            {
+                atomic_store(&dll_changed, 1);
+                glfwPostEmptyEvent();
+            }
+            /* NOTE: only wakes the loop, draw() itself recompiles compute.glsl with --watch-shader (see shader_watch.h) */
+            if (e->len > 0 && strcmp(e->name, "compute.glsl") == 0) { glfwPostEmptyEvent(); }
+        }
+    }
+    return NULL;
+}
+#else
+#include <sys/stat.h>
+#include <unistd.h> // for usleep
+
+/* NOTE: without inotify the thread polls the time the dll was modified */
+static void* dll_watch(void* arg)
+{
+    struct stat attr;
+    time_t last_mod = (stat(DLL_FILENAME, &attr) == 0) ? attr.st_mtime : 0;
+    for (;; usleep(100 * 1000))
+    {
+        if (stat(DLL_FILENAME, &attr) != 0 || attr.st_mtime == last_mod) { continue; }
+        last_mod = attr.st_mtime;
+        atomic_store(&dll_changed, 1);
+        glfwPostEmptyEvent();
+    }
+    return NULL;
+}
 #endif
+#endif
+
+/* how the window loop waits for the next frame, see --pacing */
+#define PACING_VSYNC      0 // swap interval 1, the driver waits for the display
+#define PACING_CAP        1 // at most --fps frames per second, waits for the events until the next one is due
+#define PACING_UNCAPPED   2 // as many frames as possible (the benchmark)
+#define PACING_ON_DEMAND  3 // only on input, window events and hot reloads, and while draw() is still refining the image
+#define PACING_COUNT      4
+static const char* pacing_names[PACING_COUNT] = { "vsync", "cap", "uncapped", "on-demand" };
+
+/* returns the PACING_* of name, or -1 */
+static int pacing_from_name(const char* name)
+{
+    for (int pacing = 0; pacing < PACING_COUNT; pacing++)
+    {
+        if (strcmp(name, pacing_names[pacing]) == 0) { return pacing; }
+    }
+    return -1;
+}
 
 #include <stdlib.h>
 #include <stdio.h>
-int main()
+#define BENCH_FRAME_COUNT 5 // frames to time before exiting in benchmark builds
+
+/*
+ * Scripted camera path, replayed by feeding its inputs to update() instead of the keyboard and
+ * cursor, so benchmark runs render exactly the same frames. Saved and loaded as text with one
+ * step per line: "<key> <delta cursor x> <delta cursor y> <frames>", where '.' is no key.
+ */
+typedef struct camera_step_t
+{
+    char   input;
+    double delta_cursor_x, delta_cursor_y;
+    int    frames;
+} camera_step_t;
+
+/* look around, walk towards the box, strafe and walk back, used by --bench without --camera-path */
+static const camera_step_t default_camera_path[] =
+{
+    { ' ',  0,  0, 10 },
+    { ' ',  6,  0, 20 },
+    { ' ', -6,  0, 20 },
+    { 'w',  0,  0,  4 },
+    { ' ',  0, -4, 10 },
+    { 'a',  0,  0,  6 },
+    { 'd',  0,  0,  6 },
+    { ' ',  0,  4, 10 },
+    { 's',  0,  0,  4 },
+    { 'q',  0,  0, 10 },
+};
+
+static camera_step_t* camera_path;
+static int            camera_path_length;
+
+static int load_camera_path(const char* path)
+{
+    FILE* file = fopen(path, "r");
+    if (!file) { printf("Could not open camera path %s\n", path); return 0; }
+
+    camera_step_t step;
+    while (fscanf(file, " %c %lf %lf %d", &step.input, &step.delta_cursor_x, &step.delta_cursor_y, &step.frames) == 4)
+    {
+        if (step.input == '.') { step.input = ' '; }
+        camera_path = realloc(camera_path, (camera_path_length + 1) * sizeof(camera_step_t));
+        camera_path[camera_path_length++] = step;
+    }
+    fclose(file);
+
+    if (camera_path_length == 0) { printf("Camera path %s has no steps\n", path); return 0; }
+    return 1;
+}
+
+static int camera_path_frame_count(void)
 {
+    int frames = 0;
+    for (int i = 0; i < camera_path_length; i++) { frames += camera_path[i].frames; }
+    return frames;
+}
+
+/* feeds the input of the given frame to update(), the path repeats after its last step */
+static void update_from_camera_path(state_t* state, int frame)
+{
+    frame %= camera_path_frame_count();
+    int i = 0;
+    while (frame >= camera_path[i].frames) { frame -= camera_path[i++].frames; }
+    update(state, camera_path[i].input, camera_path[i].delta_cursor_x, camera_path[i].delta_cursor_y);
+}
+
+#if !defined(_WIN32)
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <time.h> // for clock_gettime
+
+/*
+ * Creates a gl 4.3 core context without a window for render nodes and ci containers. Tries
+ * mesa's surfaceless platform first, which needs no display at all (works with llvmpipe), and
+ * falls back to a pbuffer on the default display. Returns 0 on failure.
+ */
+static int create_headless_context(void)
+{
+    EGLDisplay display = EGL_NO_DISPLAY;
+    PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display = (PFNEGLGETPLATFORMDISPLAYEXTPROC) eglGetProcAddress("eglGetPlatformDisplayEXT");
+    if (get_platform_display) { display = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL); }
+
+    int surfaceless = (display != EGL_NO_DISPLAY) && eglInitialize(display, NULL, NULL);
+    if (!surfaceless)
+    {
+        display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+        if (display == EGL_NO_DISPLAY || !eglInitialize(display, NULL, NULL)) { printf("Failed to initialize egl.\n"); return 0; }
+    }
+    if (!eglBindAPI(EGL_OPENGL_API)) { printf("Failed to bind the opengl api.\n"); return 0; }
+
+    /* NOTE: the compute shader renders into a texture, the pbuffer only exists to make the context current */
+    EGLConfig  egl_config = NULL;
+    EGLSurface surface    = EGL_NO_SURFACE;
+    if (!surfaceless)
+    {
+        const EGLint config_attribs[]  = { EGL_SURFACE_TYPE, EGL_PBUFFER_BIT, EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT, EGL_NONE };
+        const EGLint pbuffer_attribs[] = { EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE };
+        EGLint count = 0;
+        if (!eglChooseConfig(display, config_attribs, &egl_config, 1, &count) || count == 0) { printf("No egl config with pbuffer support.\n"); return 0; }
+        surface = eglCreatePbufferSurface(display, egl_config, pbuffer_attribs);
+        if (surface == EGL_NO_SURFACE) { printf("Failed to create pbuffer.\n"); return 0; }
+    }
+
+    /* NOTE: same context as the glfw window hints in main() ask for */
+    const EGLint context_attribs[] = { EGL_CONTEXT_MAJOR_VERSION, 4, EGL_CONTEXT_MINOR_VERSION, 3,
+                                       EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+                                       EGL_CONTEXT_OPENGL_DEBUG, EGL_TRUE, EGL_NONE };
+    EGLContext context = eglCreateContext(display, surfaceless ? EGL_NO_CONFIG_KHR : egl_config, EGL_NO_CONTEXT, context_attribs);
+    if (context == EGL_NO_CONTEXT || !eglMakeCurrent(display, surface, surface, context)) { printf("Failed to create egl context.\n"); return 0; }
+
+    printf("Created headless %s context\n", surfaceless ? "surfaceless" : "pbuffer");
+    return 1;
+}
+
+/* renders config->frame_count frames as fast as possible, there is no hot reload and the only input is the camera path */
+static void run_headless(state_t* state, const config_t* config)
+{
+    for (int frame = 0; frame < config->frame_count; frame++)
+    {
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+
+        if (camera_path) { update_from_camera_path(state, frame); }
+        else             { update(state, ' ', 0, 0); }
+        draw(state);
+        glFinish(); /* NOTE: wait for the dispatch so the frame time is not hidden by the driver */
+
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        printf("frame %i: %.2f ms\n", frame, 1000.0 * (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e6);
+    }
+}
+#endif
+
+/* NOTE: only remembers the size, the loop passes it to resize() once the events are polled (0x0 while minimized) */
+static int framebuffer_width, framebuffer_height;
+static void framebuffer_size_callback(GLFWwindow* window, int width, int height)
+{
+    framebuffer_width  = width;
+    framebuffer_height = height;
+}
+
+int main(int argc, char** argv)
+{
+    config_t    config           = {0};
+    const char* save_camera_path = NULL;
+    int         pacing           = PACING_VSYNC;
+    double      fps              = 60; /* of PACING_CAP */
+    #ifdef BENCH_TRIANGLE_COUNT
+    config.frame_count = BENCH_FRAME_COUNT;
+    #endif
+    config.shader_cache_path = SHADER_CACHE_PATH;
+    for (int i = 1; i < argc; i++)
+    {
+        if      (strcmp(argv[i], "--headless") == 0)            { config.headless    = 1;               }
+        else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) { config.frame_count = atoi(argv[++i]); }
+        else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) { config.record_path = argv[++i];       }
+        else if (strcmp(argv[i], "--bench") == 0 && i + 1 < argc)  { config.bench_path  = argv[++i];       }
+        else if (strcmp(argv[i], "--profile") == 0 && i + 1 < argc) { config.profile_path = argv[++i];     }
+        else if (strcmp(argv[i], "--progressive") == 0 && i + 1 < argc) { config.progressive_samples = atoi(argv[++i]); }
+        else if (strcmp(argv[i], "--frame-budget") == 0 && i + 1 < argc) { config.frame_budget_ms = atof(argv[++i]); }
+        else if (strcmp(argv[i], "--time-slice") == 0 && i + 1 < argc)   { config.slice_budget_ms = atof(argv[++i]); }
+        else if (strcmp(argv[i], "--bounces") == 0 && i + 1 < argc)      { config.bounces = atoi(argv[++i]); }
+        else if (strcmp(argv[i], "--orthographic") == 0)                 { config.orthographic = 1; }
+        else if (strcmp(argv[i], "--shader-cache") == 0 && i + 1 < argc) { config.shader_cache_path = argv[++i]; }
+        else if (strcmp(argv[i], "--no-shader-cache") == 0)              { config.shader_cache_path = NULL; }
+        else if (strcmp(argv[i], "--watch-shader") == 0)                 { config.watch_shader = 1; }
+        else if (strcmp(argv[i], "--fps") == 0 && i + 1 < argc && (fps = atof(argv[++i])) > 0) { pacing = PACING_CAP; }
+        else if (strcmp(argv[i], "--pacing") == 0 && i + 1 < argc && (pacing = pacing_from_name(argv[++i])) >= 0) {}
+        else if (strcmp(argv[i], "--size") == 0 && i + 1 < argc && sscanf(argv[++i], "%dx%d", &config.width, &config.height) == 2 && config.width > 0 && config.height > 0) {}
+        else if (strcmp(argv[i], "--camera-path") == 0 && i + 1 < argc)      { if (!load_camera_path(argv[++i])) { return 1; } }
+        else if (strcmp(argv[i], "--save-camera-path") == 0 && i + 1 < argc) { save_camera_path = argv[++i]; }
+        else
+        {
+            printf("usage: %s [--headless] [--frames count] [--record frame_%%05d.png|.ppm|.raw]\n"
+                   "          [--bench results.json|-] [--camera-path path.txt] [--save-camera-path path.txt]\n"
+                   "          [--profile trace.json|-] [--progressive samples] [--size 1920x1080]\n"
+                   "          [--frame-budget ms] [--time-slice ms] [--bounces count] [--orthographic]\n"
+                   "          [--shader-cache dir | --no-shader-cache] [--watch-shader]\n"
+                   "          [--pacing vsync|cap|uncapped|on-demand] [--fps 60]\n", argv[0]);
+            return 1;
+        }
+    }
+    /* NOTE: the benchmark replays the whole camera path once, unless --frames says otherwise */
+    if (config.bench_path && !camera_path)
+    {
+        camera_path        = (camera_step_t*) default_camera_path;
+        camera_path_length = sizeof(default_camera_path) / sizeof(default_camera_path[0]);
+    }
+    if (config.bench_path && config.frame_count <= 0) { config.frame_count = camera_path_frame_count(); }
+    if (config.headless && config.frame_count <= 0) { config.frame_count = 1; }
+    if (config.width <= 0 || config.height <= 0) { config.width = WINDOW_WIDTH; config.height = WINDOW_HEIGHT; }
+    if (config.bench_path) { pacing = PACING_UNCAPPED; } /* NOTE: the benchmark measures the frames, not the display */
+
+    #if !defined(_WIN32)
+    if (config.headless && !create_headless_context()) { return 1; }
+    #else
+    if (config.headless) { printf("Headless mode needs egl, which is not available on windows.\n"); return 1; }
+    #endif
+
     /* init glfw */
-    GLFWwindow* window;
+    GLFWwindow* window = NULL;
+    if (!config.headless)
     {
         if (!glfwInit()) { printf("Failed to initalize glfw.\n"); }
 
@@ -627,13 +1533,18 @@ int main()
         glfwWindowHint(GLFW_DECORATED, GLFW_TRUE);
         //glfwWindowHint(GLFW_TRANSPARENT_FRAMEBUFFER, GLFW_TRUE);
 
-        window = glfwCreateWindow(WINDOW_WIDTH, WINDOW_HEIGHT, WINDOW_TITLE, NULL, NULL);
+        window = glfwCreateWindow(config.width, config.height, WINDOW_TITLE, NULL, NULL);
         if (!window) { printf("Failed to create GLFW window.\n"); glfwTerminate(); }
 
+        /* NOTE: the framebuffer can be larger than the window in screen coordinates (high dpi), the images follow the framebuffer */
+        glfwGetFramebufferSize(window, &config.width, &config.height);
+        glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
+
         glfwSetWindowTitle(window, WINDOW_TITLE);
         glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
         glfwMakeContextCurrent(window);
-        glfwSwapInterval(1); // VSYNC
+        glfwSwapInterval(pacing == PACING_VSYNC); // VSYNC, only when it paces the frames
+        printf("Frame pacing: %s\n", pacing_names[pacing]);
     }
 
     #ifndef COMPILE_DLL
@@ -642,94 +1553,183 @@ int main()
     on_load      = dlsym(dll_handle, "on_load");
     update       = dlsym(dll_handle, "update");
     draw         = dlsym(dll_handle, "draw");
-    struct stat attr;
-    stat(DLL_FILENAME, &attr);
-    dll_last_mod = attr.st_mtime;
+    resize       = dlsym(dll_handle, "resize");
+    on_unload    = dlsym(dll_handle, "on_unload");
+
+    pthread_t dll_watch_thread;
+    if (!config.headless) { pthread_create(&dll_watch_thread, NULL, dll_watch, NULL); } /* NOTE: never joined, it blocks in read() until the exit */
     #endif
 
-    state_t* state = malloc(1024 * 1024);
-    memset(state, 0, 1024 * 1024);
-    on_load(state);
+    state_t* state = malloc(STATE_SIZE);
+    memset(state, 0, STATE_SIZE);
+    if (!on_load(state, &config)) { printf("Loading failed.\n"); return 1; }
+
+    #if !defined(_WIN32)
+    if (config.headless)
+    {
+        run_headless(state, &config);
+        on_unload(state);
+        printf("Terminated\n");
+        return 0;
+    }
+    #endif
 
     /* for some reason this hint is ignored when creating the window */
     //glfwSetWindowAttrib(window, GLFW_DECORATED, GLFW_FALSE);
 
+    FILE* save_camera_path_file = save_camera_path ? fopen(save_camera_path, "w") : NULL;
+    if (save_camera_path && !save_camera_path_file) { printf("Could not open %s to save the camera path\n", save_camera_path); }
+
+    int    frame      = 0;
+    int    redraw     = 1; /* of PACING_ON_DEMAND, the next frame has to be drawn */
+    double next_frame = 0; /* of PACING_CAP, time the next frame is due */
+    double title_time = 0;
     while (!glfwWindowShouldClose(window))
     {
         #ifndef COMPILE_DLL
-        /* check if dll has changed on disk */
-        if ((stat(DLL_FILENAME, &attr) == 0) && (dll_last_mod != attr.st_mtime))
+        /* NOTE: dll_watch() wakes the waits below once the dll is written */
+        if (atomic_exchange(&dll_changed, 0))
+        {
+            dll_pending     = 1;
+            dll_retry_count = 0;
+            dll_retry_time  = 0;
+        }
+        if (dll_pending && glfwGetTime() >= dll_retry_time)
         {
-            printf("Attempting code hot reload...\n");
-
             if (dll_handle) /* unload dll */
             {
+                printf("Attempting code hot reload...\n");
+                on_unload(state); /* NOTE: joins the threads of the dll before its code goes away */
                 dlclose(dll_handle);
                 dll_handle = NULL;
                 on_load    = NULL;
                 update     = NULL;
                 draw       = NULL;
+                resize     = NULL;
+                on_unload  = NULL;
             }
             dll_handle = dlopen(DLL_FILENAME, RTLD_NOW);
-            if (dll_handle == NULL) { printf("Opening DLL failed. Trying again...\n"); }
-            while (dll_handle == NULL) /* NOTE keep trying to load dll */
+            if (dll_handle)
+            {
+                on_load      = dlsym(dll_handle, "on_load");
+                update       = dlsym(dll_handle, "update");
+                draw         = dlsym(dll_handle, "draw");
+                resize       = dlsym(dll_handle, "resize");
+                on_unload    = dlsym(dll_handle, "on_unload");
+
+                /* NOTE: returns before the compute programs are compiled, the previous ones are used until then */
+                if (!on_load(state, &config)) { printf("Loading failed.\n"); }
+                dll_pending     = 0;
+                dll_retry_count = 0;
+                dll_retry_time  = 0;
+                redraw          = 1;
+            }
+            else
             {
-                dll_handle = dlopen(DLL_FILENAME, RTLD_NOW);
+                /* NOTE: the linker may still be writing the dll, back off instead of spinning on dlopen */
+                dll_retry_delay = (dll_retry_count == 0) ? DLL_RETRY_DELAY_MIN : 2 * dll_retry_delay;
+                if (dll_retry_delay > DLL_RETRY_DELAY_MAX) { dll_retry_delay = DLL_RETRY_DELAY_MAX; }
+                dll_retry_time = glfwGetTime() + dll_retry_delay;
+                if (++dll_retry_count < DLL_RETRY_COUNT) { printf("Opening DLL failed. Trying again in %.0f ms...\n", 1000 * dll_retry_delay); }
+                else
+                {
+                    printf("Opening DLL failed: %s, waiting for it to change\n", dlerror());
+                    dll_pending     = 0;
+                    dll_retry_count = 0;
+                }
             }
-            on_load      = dlsym(dll_handle, "on_load");
-            update       = dlsym(dll_handle, "update");
-            draw         = dlsym(dll_handle, "draw");
+        }
 
-            on_load(state);
-            dll_last_mod = attr.st_mtime;
+        /* NOTE: nothing to draw without a dll, sleep until the next try or until it changes */
+        if (!dll_handle)
+        {
+            if (dll_pending) { glfwWaitEventsTimeout(dll_retry_time - glfwGetTime()); }
+            else             { glfwWaitEvents(); }
+            continue;
         }
         #endif
 
+        /* wait for the next frame, NOTE: the waits return early on events, the loop then checks the dll again */
+        if (pacing == PACING_CAP)
+        {
+            double now = glfwGetTime();
+            if (now < next_frame) { glfwWaitEventsTimeout(next_frame - now); continue; }
+            next_frame = (now - next_frame < 1 / fps) ? next_frame + 1 / fps : now + 1 / fps; /* NOTE: a frame that is late does not make the next ones hurry */
+        }
+        else if (pacing == PACING_ON_DEMAND && !redraw)
+        {
+            glfwWaitEvents();
+            redraw = 1;
+            continue;
+        }
+
         static double time;
         float dt = glfwGetTime() - time;
-        const double fps_cap = 1.f / 60.f;
+        time = glfwGetTime();
 
-        if (dt > fps_cap) {
-            time = glfwGetTime();
-
-            /* NOTE: do not set window title in a loop with uncapped fps */
+        /* NOTE: a few times per second, setting the title every frame costs a lot when uncapped */
+        if (time - title_time > 0.25)
+        {
             char fps_string[30];
             sprintf(fps_string, "%f", 1/dt);
             glfwSetWindowTitle(window, fps_string);
+            title_time = time;
+        }
+
+        /* poll events */
+        static double cursor_x = 0, cursor_y = 0;
+        char input = ' ';
+        {
+            glfwPollEvents();
 
-            /* poll events */
-            static double cursor_x = 0, cursor_y = 0;
+            /* NOTE: kept in config so a hot reload creates the images with the size of the window */
+            if (framebuffer_width > 0 && framebuffer_height > 0 && (framebuffer_width != config.width || framebuffer_height != config.height))
             {
-                char input = ' ';
-
-                glfwPollEvents();
-
-                /* key inputs */
-                if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS) { glfwSetWindowShouldClose(window, 1); }
-                if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS)      { input = 'w'; }
-                if (glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS)      { input = 'a'; }
-                if (glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS)      { input = 's'; }
-                if (glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS)      { input = 'd'; }
-                if (glfwGetKey(window, GLFW_KEY_Q) == GLFW_PRESS)      { input = 'q'; }
-                if (glfwGetKey(window, GLFW_KEY_E) == GLFW_PRESS)      { input = 'e'; }
-
-                /* cursor pos */
-                double x,y;
-                glfwGetCursorPos(window, &x, &y);
-                double dx = x - cursor_x;
-                double dy = y - cursor_y;
-                cursor_x = x;
-                cursor_y = y;
-
-                update(state, input, dx, dy);
+                config.width  = framebuffer_width;
+                config.height = framebuffer_height;
+                resize(state, config.width, config.height);
             }
 
-
-            draw(state);
-            glfwSwapBuffers(window);
+            /* key inputs */
+            if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS) { glfwSetWindowShouldClose(window, 1); }
+            if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS)      { input = 'w'; }
+            if (glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS)      { input = 'a'; }
+            if (glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS)      { input = 's'; }
+            if (glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS)      { input = 'd'; }
+            if (glfwGetKey(window, GLFW_KEY_Q) == GLFW_PRESS)      { input = 'q'; }
+            if (glfwGetKey(window, GLFW_KEY_E) == GLFW_PRESS)      { input = 'e'; }
+
+            /* cursor pos */
+            double x,y;
+            glfwGetCursorPos(window, &x, &y);
+            double dx = x - cursor_x;
+            double dy = y - cursor_y;
+            cursor_x = x;
+            cursor_y = y;
+
+            if (save_camera_path_file) { fprintf(save_camera_path_file, "%c %.9g %.9g 1\n", input == ' ' ? '.' : input, dx, dy); }
+
+            if (camera_path) { update_from_camera_path(state, frame); }
+            else             { update(state, input, dx, dy); }
         }
+
+
+        /* NOTE: a held key moves the camera without new events, a camera path moves it every frame */
+        redraw = draw(state) || input != ' ' || camera_path != NULL;
+
+        #ifdef BENCH_TRIANGLE_COUNT
+        /* NOTE: wait for the dispatch so the frame time is not hidden by the driver, see bench.sh */
+        glFinish();
+        printf("frame %i: %.2f ms\n", frame, 1000.0 * (glfwGetTime() - time));
+        #endif
+
+        if (++frame == config.frame_count) { glfwSetWindowShouldClose(window, 1); }
+
+        glfwSwapBuffers(window);
     }
 
+    on_unload(state);
+    if (save_camera_path_file) { fclose(save_camera_path_file); }
     printf("Terminated\n");
 
     return 0;
@@ -0,0 +1,148 @@
+/*
+ * Gpu time of every stage of draw() (main --profile - or main --profile trace.json).
+ *
+ * Every frame puts a GL_TIMESTAMP query before the first and after each stage into one of a few
+ * query pools. A pool is read back when it comes around again, PROFILE_POOL_COUNT - 1 frames
+ * later, so the results are there without waiting for the gpu. If they are not, the frame is
+ * dropped instead. The stage times go into a rolling history that is printed to stdout, or
+ * streamed into a chrome trace (load it in chrome://tracing or https://ui.perfetto.dev).
+ *
+ * NOTE: expects the gl functions (glew) to be declared.
+ */
+
+/* stages of draw(), in order */
+#define PROFILE_STAGE_CLEAR      0
+#define PROFILE_STAGE_DISPATCH   1
+#define PROFILE_STAGE_BARRIER    2
+#define PROFILE_STAGE_RECORD     3
+#define PROFILE_STAGE_BLIT       4
+#define PROFILE_STAGE_COUNT      5
+static const char* profile_stage_names[PROFILE_STAGE_COUNT] = { "clear", "dispatch", "barrier", "record", "blit" };
+
+#define PROFILE_POOL_COUNT       3   // frames in flight, results are read PROFILE_POOL_COUNT - 1 frames late
+#define PROFILE_HISTORY        128   // frames of the rolling statistics
+#define PROFILE_PRINT_INTERVAL  60   // frames between two prints to stdout
+
+typedef struct profile_t
+{
+    int          active;
+    const char*  path;  /* "-" prints to stdout, anything else is the chrome trace */
+    FILE*        trace;
+    int          frame; /* number of the frame being drawn */
+    int          pool;  /* pool of the frame being drawn */
+    uint         dropped;
+
+    /* timestamps before the first and after every stage, pool_frame is -1 once read */
+    unsigned int query[PROFILE_POOL_COUNT][PROFILE_STAGE_COUNT + 1];
+    int          pool_frame[PROFILE_POOL_COUNT];
+    GLuint64     first_timestamp; /* in ns, start of the trace */
+
+    /* in ms, the last entry is the whole frame */
+    float        history[PROFILE_STAGE_COUNT + 1][PROFILE_HISTORY];
+    uint         history_count;
+} profile_t;
+
+static void profile_start(profile_t* profile, const char* path)
+{
+    memset(profile, 0, sizeof(profile_t));
+    profile->active = 1;
+    profile->path   = path;
+    for (int n = 0; n < PROFILE_POOL_COUNT; n++) { profile->pool_frame[n] = -1; }
+    glGenQueries(PROFILE_POOL_COUNT * (PROFILE_STAGE_COUNT + 1), &profile->query[0][0]);
+
+    if (strcmp(path, "-") != 0)
+    {
+        /* NOTE: chrome's json array format allows leaving out the closing ], so the trace stays valid at any point */
+        profile->trace = fopen(path, "w");
+        if (!profile->trace) { printf("Could not open %s for the trace\n", path); }
+        else                 { fprintf(profile->trace, "[\n"); }
+    }
+}
+
+static void profile_read(profile_t* profile, int pool)
+{
+    unsigned int available = 0;
+    glGetQueryObjectuiv(profile->query[pool][PROFILE_STAGE_COUNT], GL_QUERY_RESULT_AVAILABLE, &available);
+    if (!available) { profile->dropped++; profile->pool_frame[pool] = -1; return; } /* NOTE: do not stall, lose the frame */
+
+    GLuint64 timestamps[PROFILE_STAGE_COUNT + 1];
+    for (int n = 0; n <= PROFILE_STAGE_COUNT; n++) { glGetQueryObjectui64v(profile->query[pool][n], GL_QUERY_RESULT, &timestamps[n]); }
+    if (profile->first_timestamp == 0) { profile->first_timestamp = timestamps[0]; }
+
+    uint entry = profile->history_count++ % PROFILE_HISTORY;
+    for (int n = 0; n < PROFILE_STAGE_COUNT; n++)
+    {
+        profile->history[n][entry] = (timestamps[n + 1] - timestamps[n]) / 1e6;
+        if (profile->trace)
+        {
+            fprintf(profile->trace, "{\"name\": \"%s\", \"cat\": \"gpu\", \"ph\": \"X\", \"pid\": 0, \"tid\": 0, \"ts\": %.3f, \"dur\": %.3f, \"args\": {\"frame\": %d}},\n",
+                    profile_stage_names[n], (timestamps[n] - profile->first_timestamp) / 1e3, (timestamps[n + 1] - timestamps[n]) / 1e3, profile->pool_frame[pool]);
+        }
+    }
+    profile->history[PROFILE_STAGE_COUNT][entry] = (timestamps[PROFILE_STAGE_COUNT] - timestamps[0]) / 1e6;
+    profile->pool_frame[pool] = -1;
+}
+
+/* prints mean and max of every stage over the last PROFILE_HISTORY frames */
+static void profile_print(const profile_t* profile)
+{
+    uint count = (profile->history_count < PROFILE_HISTORY) ? profile->history_count : PROFILE_HISTORY;
+    if (count == 0) { return; }
+
+    printf("gpu ms over %u frames (mean/max):", count);
+    for (int n = 0; n <= PROFILE_STAGE_COUNT; n++)
+    {
+        float sum = 0, max = 0;
+        for (uint i = 0; i < count; i++) { sum += profile->history[n][i]; if (profile->history[n][i] > max) { max = profile->history[n][i]; } }
+        printf(" %s %.3f/%.3f", (n < PROFILE_STAGE_COUNT) ? profile_stage_names[n] : "| frame", sum / count, max);
+    }
+    if (profile->dropped) { printf(" (dropped %u)", profile->dropped); }
+    printf("\n");
+}
+
+/*
+ * NOTE: profile_begin(), profile_stage() and profile_end() do nothing unless profiling, so draw()
+ * can call them unconditionally between its stages
+ */
+
+/* call at the start of draw(), reads back the pool of PROFILE_POOL_COUNT frames ago */
+static void profile_begin(profile_t* profile)
+{
+    if (!profile->active) { return; }
+    profile->pool = profile->frame % PROFILE_POOL_COUNT;
+    if (profile->pool_frame[profile->pool] >= 0) { profile_read(profile, profile->pool); }
+
+    profile->pool_frame[profile->pool] = profile->frame;
+    glQueryCounter(profile->query[profile->pool][0], GL_TIMESTAMP);
+}
+
+/* call after every stage, in order, also for stages that were skipped */
+static void profile_stage(profile_t* profile, int stage)
+{
+    if (!profile->active) { return; }
+    glQueryCounter(profile->query[profile->pool][stage + 1], GL_TIMESTAMP);
+}
+
+/* call at the end of draw() */
+static void profile_end(profile_t* profile)
+{
+    if (!profile->active) { return; }
+    profile->frame++;
+    if (profile->trace) { fflush(profile->trace); }
+    else if (profile->frame % PROFILE_PRINT_INTERVAL == 0) { profile_print(profile); }
+}
+
+/* reads back every frame still in flight and prints the statistics, called from on_unload() */
+static void profile_flush(profile_t* profile)
+{
+    if (!profile->active) { return; }
+
+    glFinish(); /* NOTE: waiting is fine here, nothing is drawn anymore */
+    for (int frame = profile->frame - PROFILE_POOL_COUNT; frame < profile->frame; frame++)
+    {
+        int pool = (frame >= 0) ? frame % PROFILE_POOL_COUNT : -1;
+        if (pool >= 0 && profile->pool_frame[pool] == frame) { profile_read(profile, pool); }
+    }
+    if (profile->trace) { fflush(profile->trace); }
+    else                { profile_print(profile); }
+}
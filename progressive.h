@@ -0,0 +1,110 @@
+/*
+ * Progressive rendering (main --progressive <samples>).
+ *
+ * While the camera does not move, every frame adds one more sample per pixel, at a jittered
+ * position inside the pixel, to an RGBA32F accumulation image and shows the mean of the samples
+ * (see accumulate_sample() in compute.glsl). After PROGRESSIVE_MIN_SAMPLES, only the tiles whose
+ * error is still above PROGRESSIVE_NOISE_THRESHOLD get more samples (see compact_tiles()). Once the
+ * target sample count is reached, or no pixel is noisy anymore, draw() stops dispatching until the
+ * camera moves or the dll is reloaded.
+ *
+ * The shader counts the noisy pixels of a frame into one of PROGRESSIVE_SLOT_COUNT slots of a
+ * buffer. A slot is read back once the fence after its frame is signaled, so draw() does not wait
+ * for the gpu unless it runs out of slots.
+ *
+ * NOTE: expects the gl functions (glew) to be declared.
+ */
+
+typedef struct progressive_t
+{
+    int          active;
+    uint         target_samples;
+    uint         sample_count; /* samples in the accumulation image */
+    camera_t     camera;       /* the samples were taken with */
+    int          converged;    /* nothing is dispatched until the next reset */
+
+    unsigned int buffer_id;    /* noisy pixel counts, see SSBO_NOISE */
+    uint         slot;         /* of the frame being drawn */
+    GLsync       fence[PROGRESSIVE_SLOT_COUNT];        /* 0 if nothing is in flight */
+    uint         slot_samples[PROGRESSIVE_SLOT_COUNT]; /* sample count after the frame that wrote the slot */
+} progressive_t;
+
+static void progressive_start(progressive_t* progressive, uint target_samples, unsigned int buffer_id)
+{
+    memset(progressive, 0, sizeof(progressive_t));
+    progressive->active         = 1;
+    progressive->target_samples = target_samples;
+    progressive->buffer_id      = buffer_id;
+}
+
+/* starts over with the next frame, call when anything but the sample position changes */
+static void progressive_reset(progressive_t* progressive)
+{
+    progressive->sample_count = 0;
+    progressive->converged    = 0;
+    for (int n = 0; n < PROGRESSIVE_SLOT_COUNT; n++)
+    {
+        if (progressive->fence[n]) { glDeleteSync(progressive->fence[n]); progressive->fence[n] = 0; }
+    }
+}
+
+/* reads back the noisy pixel count of the slot, wait blocks until the gpu is done with its frame */
+static int progressive_read(progressive_t* progressive, uint slot, int wait)
+{
+    GLenum status = glClientWaitSync(progressive->fence[slot], wait ? GL_SYNC_FLUSH_COMMANDS_BIT : 0, wait ? 1000000000 : 0);
+    if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) { return 0; }
+    glDeleteSync(progressive->fence[slot]);
+    progressive->fence[slot] = 0;
+
+    uint noisy = 0;
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, progressive->buffer_id);
+    glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, slot * sizeof(uint), sizeof(uint), &noisy);
+
+    if (noisy == 0 && progressive->slot_samples[slot] >= PROGRESSIVE_MIN_SAMPLES && !progressive->converged)
+    {
+        printf("Converged after %u samples\n", progressive->slot_samples[slot]);
+        progressive->converged = 1;
+    }
+    return 1;
+}
+
+/*
+ * call at the start of draw() with the camera of the frame, returns 0 once there is nothing left
+ * to dispatch. Otherwise the sample goes to sample_count and its noisy pixels into slot.
+ */
+static int progressive_begin(progressive_t* progressive, const camera_t* camera)
+{
+    if (memcmp(camera, &progressive->camera, sizeof(camera_t)) != 0)
+    {
+        progressive_reset(progressive);
+        progressive->camera = *camera;
+    }
+
+    for (uint n = 0; n < PROGRESSIVE_SLOT_COUNT; n++)
+    {
+        if (progressive->fence[n]) { progressive_read(progressive, n, 0); }
+    }
+    if (progressive->sample_count >= progressive->target_samples && !progressive->converged)
+    {
+        printf("Reached %u samples\n", progressive->sample_count);
+        progressive->converged = 1;
+    }
+    if (progressive->converged) { return 0; }
+
+    progressive->slot = progressive->sample_count % PROGRESSIVE_SLOT_COUNT;
+    if (progressive->fence[progressive->slot]) { progressive_read(progressive, progressive->slot, 1); }
+
+    /* NOTE: NULL clears the count to 0 */
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, progressive->buffer_id);
+    glClearBufferSubData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, progressive->slot * sizeof(uint), sizeof(uint), GL_RED_INTEGER, GL_UNSIGNED_INT, NULL);
+    return 1;
+}
+
+/* call after the dispatch */
+static void progressive_end(progressive_t* progressive)
+{
+    progressive->sample_count++;
+    if (progressive->fence[progressive->slot]) { glDeleteSync(progressive->fence[progressive->slot]); } /* NOTE: only if the wait in progressive_begin() timed out */
+    progressive->slot_samples[progressive->slot] = progressive->sample_count;
+    progressive->fence[progressive->slot]        = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
@@ -0,0 +1,324 @@
+/*
+ * Records the frames of the compute shader to disk without stalling the renderer.
+ *
+ * draw() queues a copy of the output texture into one of a small ring of pixel buffer objects
+ * (glGetTexImage into a bound GL_PIXEL_PACK_BUFFER returns right away) and puts a fence behind
+ * it. Buffers whose fence has signaled are mapped a few frames later, copied into a frame and
+ * handed to a writer thread, which encodes it as ppm, png or raw rgba and writes it out. The
+ * render loop only ever waits on the gpu when all buffers of the ring are still in flight.
+ *
+ * NOTE: expects the gl functions (glew) and the structs of common.h to be declared.
+ */
+#include <stdint.h> // for uint32_t
+
+#if defined(_WIN32)
+/* NOTE: maps the few pthread calls used here to win32, the build on windows has no pthreads */
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+typedef HANDLE             pthread_t;
+typedef CRITICAL_SECTION   pthread_mutex_t;
+typedef CONDITION_VARIABLE pthread_cond_t;
+#define pthread_mutex_init(mutex, attr)   InitializeCriticalSection(mutex)
+#define pthread_mutex_destroy(mutex)      DeleteCriticalSection(mutex)
+#define pthread_mutex_lock(mutex)         EnterCriticalSection(mutex)
+#define pthread_mutex_unlock(mutex)       LeaveCriticalSection(mutex)
+#define pthread_cond_init(cond, attr)     InitializeConditionVariable(cond)
+#define pthread_cond_destroy(cond)        ((void) (cond))
+#define pthread_cond_wait(cond, mutex)    SleepConditionVariableCS(cond, mutex, INFINITE)
+#define pthread_cond_signal(cond)         WakeConditionVariable(cond)
+#define pthread_create(thread, attr, main, arg) (*(thread) = CreateThread(NULL, 0, (LPTHREAD_START_ROUTINE) (main), arg, 0, NULL))
+#define pthread_join(thread, result)      (WaitForSingleObject(thread, INFINITE), CloseHandle(thread))
+#else
+#include <pthread.h>
+#endif
+
+#define RECORD_PBO_COUNT     3  // frames that can be in flight between the gpu and the cpu
+#define RECORD_QUEUE_SIZE   16  // frames waiting for the writer thread before new ones get dropped
+#define RECORD_PIXEL_SIZE    4  // rgba8, same as the output texture
+
+#define RECORD_FORMAT_PPM    0
+#define RECORD_FORMAT_PNG    1
+#define RECORD_FORMAT_RAW    2
+
+typedef struct record_frame_t
+{
+    unsigned char* pixels; /* frame_size bytes of the record_t, row 0 is the top of the image, the texture is flipped when it is copied out of the pixel buffer */
+    int            index;  /* frame number, used for the file name */
+} record_frame_t;
+
+typedef struct record_t
+{
+    int          active;
+    const char*  path;   /* printf pattern with the frame number, e.g. "frame_%05d.png" */
+    int          format;
+    uint         width;  /* of the output texture, a resize starts a new recording */
+    uint         height;
+    size_t       frame_size; /* in bytes */
+    int          frame;  /* number of the next frame to read back */
+    uint         queued;  /* frames handed to the writer thread */
+    uint         dropped;
+
+    /* ring of pixel buffers, pbo_first is the oldest one in flight */
+    unsigned int pbo[RECORD_PBO_COUNT];
+    GLsync       fence[RECORD_PBO_COUNT];
+    int          pbo_frame[RECORD_PBO_COUNT];
+    uint         pbo_first;
+    uint         pbo_count;
+
+    /* frames for the writer thread, queue_first is the oldest one, free_frames are ready for reuse */
+    record_frame_t  queue[RECORD_QUEUE_SIZE];
+    uint            queue_first;
+    uint            queue_count;
+    unsigned char*  free_frames[RECORD_QUEUE_SIZE];
+    uint            free_count;
+    int             quit;
+    pthread_t       thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t  cond;
+} record_t;
+
+/* png helper, see https://www.w3.org/TR/png/ */
+static uint32_t png_crc(uint32_t crc, const unsigned char* data, size_t size)
+{
+    static uint32_t table[256];
+    if (!table[1])
+    {
+        for (uint32_t n = 0; n < 256; n++)
+        {
+            uint32_t c = n;
+            for (int k = 0; k < 8; k++) { c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1; }
+            table[n] = c;
+        }
+    }
+    crc = ~crc;
+    for (size_t i = 0; i < size; i++) { crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8); }
+    return ~crc;
+}
+
+static void png_u32(unsigned char* out, uint32_t value)
+{
+    out[0] = value >> 24; out[1] = value >> 16; out[2] = value >> 8; out[3] = value;
+}
+
+static void png_chunk(FILE* file, const char* type, const unsigned char* data, uint32_t size)
+{
+    unsigned char header[8];
+    png_u32(header, size);
+    memcpy(header + 4, type, 4);
+    uint32_t crc = png_crc(png_crc(0, header + 4, 4), data, size);
+
+    unsigned char footer[4];
+    png_u32(footer, crc);
+    fwrite(header, 1, 8, file);
+    fwrite(data, 1, size, file);
+    fwrite(footer, 1, 4, file);
+}
+
+/*
+ * writes an rgb png with the image data in stored (uncompressed) deflate blocks, which avoids
+ * depending on zlib and keeps the writer thread cheap at the cost of file size
+ */
+static void write_png(FILE* file, const unsigned char* rgba, uint32_t width, uint32_t height)
+{
+    const uint32_t row_size  = 1 + 3 * width; /* filter type + rgb */
+    const uint32_t raw_size  = row_size * height;
+    const uint32_t block_max = 65535;
+    const uint32_t blocks    = (raw_size + block_max - 1) / block_max;
+
+    static const unsigned char signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+    fwrite(signature, 1, 8, file);
+
+    unsigned char ihdr[13] = {0};
+    png_u32(ihdr, width);
+    png_u32(ihdr + 4, height);
+    ihdr[8] = 8; /* bit depth */
+    ihdr[9] = 2; /* truecolor */
+    png_chunk(file, "IHDR", ihdr, sizeof(ihdr));
+
+    /* zlib stream: header, stored blocks (5 byte header each) and the adler32 of the raw data */
+    uint32_t       idat_size = 2 + 5 * blocks + raw_size + 4;
+    unsigned char* idat      = malloc(idat_size);
+    unsigned char* raw       = idat + 2 + 5 * blocks; /* NOTE: rows are written here first, then moved into the blocks */
+    for (uint32_t y = 0; y < height; y++)
+    {
+        unsigned char* row = raw + y * row_size;
+        row[0] = 0; /* no filter */
+        for (uint32_t x = 0; x < width; x++) { memcpy(row + 1 + 3 * x, rgba + RECORD_PIXEL_SIZE * (y * width + x), 3); }
+    }
+
+    uint32_t a = 1, b = 0;
+    for (uint32_t i = 0; i < raw_size; i++) { a = (a + raw[i]) % 65521; b = (b + a) % 65521; }
+
+    idat[0] = 0x78;
+    idat[1] = 0x01;
+    unsigned char* out = idat + 2;
+    for (uint32_t block = 0; block < blocks; block++)
+    {
+        uint32_t size = (raw_size - block * block_max < block_max) ? raw_size - block * block_max : block_max;
+        memmove(out + 5, raw + block * block_max, size); /* NOTE: moves towards the start, never overwrites unread data */
+        out[0] = (block == blocks - 1);
+        out[1] = size & 0xff; out[2] = size >> 8;
+        out[3] = ~size & 0xff; out[4] = (~size >> 8) & 0xff;
+        out += 5 + size;
+    }
+    png_u32(out, (b << 16) | a);
+
+    png_chunk(file, "IDAT", idat, idat_size);
+    png_chunk(file, "IEND", NULL, 0);
+    free(idat);
+}
+
+static void record_write_frame(const record_t* record, const record_frame_t* frame)
+{
+    char path[1024];
+    snprintf(path, sizeof(path), record->path, frame->index);
+
+    FILE* file = fopen(path, "wb");
+    if (!file) { printf("Could not open %s for recording\n", path); return; }
+
+    if (record->format == RECORD_FORMAT_PNG) { write_png(file, frame->pixels, record->width, record->height); }
+    else if (record->format == RECORD_FORMAT_RAW) { fwrite(frame->pixels, 1, record->frame_size, file); }
+    else
+    {
+        fprintf(file, "P6 %u %u 255\n", record->width, record->height);
+        for (uint i = 0; i < record->width * record->height; i++) { fwrite(frame->pixels + RECORD_PIXEL_SIZE * i, 1, 3, file); }
+    }
+    fclose(file);
+}
+
+static void* record_writer_main(void* arg)
+{
+    record_t* record = arg;
+
+    pthread_mutex_lock(&record->mutex);
+    for (;;)
+    {
+        while (record->queue_count == 0 && !record->quit) { pthread_cond_wait(&record->cond, &record->mutex); }
+        if (record->queue_count == 0) { break; } /* NOTE: only quits once the queue is drained */
+
+        record_frame_t frame = record->queue[record->queue_first];
+        record->queue_first  = (record->queue_first + 1) % RECORD_QUEUE_SIZE;
+        record->queue_count--;
+
+        /* encode and write without holding the lock, so the render thread can keep queueing */
+        pthread_mutex_unlock(&record->mutex);
+        record_write_frame(record, &frame);
+        pthread_mutex_lock(&record->mutex);
+
+        record->free_frames[record->free_count++] = frame.pixels;
+    }
+    pthread_mutex_unlock(&record->mutex);
+    return NULL;
+}
+
+/* starts recording to path, the format is picked by its extension (.png, .raw, anything else is ppm) */
+static void record_start(record_t* record, const char* path, int first_frame, uint width, uint height)
+{
+    memset(record, 0, sizeof(record_t));
+    record->active     = 1;
+    record->path       = path;
+    record->frame      = first_frame;
+    record->width      = width;
+    record->height     = height;
+    record->frame_size = (size_t) RECORD_PIXEL_SIZE * width * height;
+
+    const char* extension = strrchr(path, '.');
+    if      (extension && strcmp(extension, ".png") == 0) { record->format = RECORD_FORMAT_PNG; }
+    else if (extension && strcmp(extension, ".raw") == 0) { record->format = RECORD_FORMAT_RAW; }
+    else                                                   { record->format = RECORD_FORMAT_PPM; }
+
+    glGenBuffers(RECORD_PBO_COUNT, record->pbo);
+    for (int n = 0; n < RECORD_PBO_COUNT; n++)
+    {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, record->pbo[n]);
+        glBufferData(GL_PIXEL_PACK_BUFFER, record->frame_size, NULL, GL_STREAM_READ);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    for (int n = 0; n < RECORD_QUEUE_SIZE; n++) { record->free_frames[record->free_count++] = malloc(record->frame_size); }
+
+    pthread_mutex_init(&record->mutex, NULL);
+    pthread_cond_init(&record->cond, NULL);
+    pthread_create(&record->thread, NULL, record_writer_main, record);
+}
+
+/* maps the oldest pixel buffer and hands its frame to the writer, wait blocks until the gpu is done with it */
+static int record_retire(record_t* record, int wait)
+{
+    if (record->pbo_count == 0) { return 0; }
+
+    uint   n      = record->pbo_first;
+    GLenum status = glClientWaitSync(record->fence[n], GL_SYNC_FLUSH_COMMANDS_BIT, wait ? GL_TIMEOUT_IGNORED : 0);
+    if (status == GL_TIMEOUT_EXPIRED) { return 0; } /* still in flight */
+    glDeleteSync(record->fence[n]);
+
+    pthread_mutex_lock(&record->mutex);
+    unsigned char* pixels = (record->free_count > 0) ? record->free_frames[--record->free_count] : NULL;
+    pthread_mutex_unlock(&record->mutex);
+
+    if (pixels)
+    {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, record->pbo[n]);
+        const void* data = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, record->frame_size, GL_MAP_READ_BIT);
+        /* NOTE: row 0 of the texture is the bottom of the window (see the blit in draw()), the files start with the top row */
+        size_t row_size = (size_t) RECORD_PIXEL_SIZE * record->width;
+        for (uint y = 0; data && y < record->height; y++) { memcpy(pixels + row_size * y, (const unsigned char*) data + row_size * (record->height - 1 - y), row_size); }
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+        pthread_mutex_lock(&record->mutex);
+        record->queue[(record->queue_first + record->queue_count) % RECORD_QUEUE_SIZE] = (record_frame_t){pixels, record->pbo_frame[n]};
+        record->queue_count++;
+        record->queued++;
+        pthread_cond_signal(&record->cond);
+        pthread_mutex_unlock(&record->mutex);
+    }
+    else { record->dropped++; } /* NOTE: the writer cannot keep up, drop the frame rather than stall rendering */
+
+    record->pbo_first = (record->pbo_first + 1) % RECORD_PBO_COUNT;
+    record->pbo_count--;
+    return 1;
+}
+
+/* queues the read back of the texture, call after the dispatch that writes it */
+static void record_frame(record_t* record, unsigned int texture_id)
+{
+    /* hand every finished frame to the writer, only wait for the gpu if the whole ring is in flight */
+    while (record_retire(record, 0)) {}
+    if (record->pbo_count == RECORD_PBO_COUNT) { record_retire(record, 1); }
+
+    uint n = (record->pbo_first + record->pbo_count) % RECORD_PBO_COUNT;
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, record->pbo[n]);
+    glBindTexture(GL_TEXTURE_2D, texture_id);
+    glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_UNSIGNED_BYTE, 0); /* NOTE: returns right away, the copy happens on the gpu */
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    record->fence[n]     = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    record->pbo_frame[n] = record->frame++;
+    record->pbo_count++;
+}
+
+/* writes out every frame still in flight and stops the writer thread */
+static void record_stop(record_t* record)
+{
+    if (!record->active) { return; }
+
+    while (record_retire(record, 1)) {}
+
+    pthread_mutex_lock(&record->mutex);
+    record->quit = 1;
+    pthread_cond_signal(&record->cond);
+    pthread_mutex_unlock(&record->mutex);
+    pthread_join(record->thread, NULL);
+
+    printf("Recorded %u frames to %s", record->queued, record->path);
+    if (record->dropped) { printf(" (dropped %u, the writer could not keep up)", record->dropped); }
+    printf("\n");
+
+    for (uint n = 0; n < record->free_count; n++) { free(record->free_frames[n]); }
+    glDeleteBuffers(RECORD_PBO_COUNT, record->pbo);
+    pthread_mutex_destroy(&record->mutex);
+    pthread_cond_destroy(&record->cond);
+    record->active = 0;
+}
@@ -1,3 +1,16 @@
 #!/bin/bash
 
 MESA_GLSL_VERSION_OVERRIDE=430 MESA_GL_VERSION_OVERRIDE=4.3FC ./main
+
+# NOTE: on machines without a display use e.g. ./main --headless --frames 10
+# NOTE: record the frames with e.g. ./main --record frame_%05d.png (or .ppm, .raw)
+# NOTE: benchmark with e.g. ./main --bench results.json (disables vsync and the fps cap and replays a camera path, see --camera-path)
+# NOTE: gpu time per stage with e.g. ./main --profile - (rolling statistics) or ./main --profile trace.json (chrome://tracing)
+# NOTE: accumulate up to 256 samples per pixel while the camera stands still with e.g. ./main --progressive 256 (stops rendering once converged)
+# NOTE: render at another size with e.g. ./main --headless --size 3840x2160 --record frame_%05d.png (the window size follows resizes)
+# NOTE: hold a gpu frame time of e.g. 16.6 ms by tracing fewer pixels with ./main --frame-budget 16.6 (not while benchmarking or recording)
+# NOTE: trace at most e.g. 8 ms of tiles per frame and finish the image over the next frames with ./main --time-slice 8
+# NOTE: trace e.g. a single bounce with ./main --bounces 1, or an orthographic projection with ./main --orthographic (each variant is compiled once and cached)
+# NOTE: compiled programs are kept in ./shader_cache and loaded from there on the next start, see --shader-cache dir and --no-shader-cache
+# NOTE: recompile only the compute programs when compute.glsl is saved with ./main --watch-shader (linux, used by dev.sh)
+# NOTE: pace the frames with ./main --pacing vsync (default), --fps 30 (cap), --pacing uncapped, or --pacing on-demand (draws only on input, window events and hot reloads, and until the progressive image converges)
@@ -0,0 +1,81 @@
+/*
+ * Dynamic resolution (main --frame-budget 16.6).
+ *
+ * Holds the gpu time of the dispatches at a budget by tracing only a rect of the images, which
+ * stay allocated at the size of the window. The rect starts at the top left corner, the blit in
+ * draw() stretches it over the window with bilinear filtering. The gpu time is measured with
+ * timer.h without waiting for it. The cost is about proportional to the traced pixels, so a frame that took ms at a
+ * scale s would have met the budget at s * sqrt(budget / ms). The controller moves part of the
+ * way there, and only once a frame is over the budget or below SCALE_HEADROOM of it, so the rect
+ * does not change with every bit of noise in the timings.
+ *
+ * NOTE: expects the gl functions (glew) to be declared.
+ */
+#include <math.h> // for sqrt, ceil
+
+#define SCALE_MIN            0.25f // of the width and height of the images
+#define SCALE_HEADROOM       0.8f  // fraction of the budget below which the rect grows again
+#define SCALE_GAIN           0.5f  // fraction of the way to the scale that would have met the budget
+#define SCALE_STEP           (1.0f / 64) // the scale is rounded to this, small corrections do not change the rect
+
+typedef struct scale_t
+{
+    int          active;
+    float        budget_ms;
+    float        scale;  /* of the traced rect, SCALE_MIN to 1 */
+    float        target; /* scale the controller moves towards, applied by scale_update() */
+    uint         width;  /* traced rect, all of the images unless active */
+    uint         height;
+    gpu_timer_t  timer;  /* of the dispatches, tagged with their scale */
+} scale_t;
+
+static void scale_start(scale_t* scale, float budget_ms)
+{
+    memset(scale, 0, sizeof(scale_t));
+    scale->active    = 1;
+    scale->budget_ms = budget_ms;
+    scale->scale     = 1;
+    scale->target    = 1;
+    gpu_timer_start(&scale->timer);
+}
+
+/* sets the traced rect for images of width x height, call when they are (re)allocated */
+static void scale_resize(scale_t* scale, uint width, uint height)
+{
+    float s = scale->active ? scale->scale : 1;
+    scale->width  = (uint) ceil(s * width);
+    scale->height = (uint) ceil(s * height);
+}
+
+/* reads back the oldest query if it is available and moves the target */
+static int scale_retire(scale_t* scale)
+{
+    double ms, traced_scale;
+    if (!gpu_timer_retire(&scale->timer, 0, &ms, &traced_scale)) { return 0; }
+
+    /* NOTE: aims for the middle of [SCALE_HEADROOM * budget, budget], the frame may have been traced at an older scale */
+    if (ms <= 0 || (ms <= scale->budget_ms && ms >= SCALE_HEADROOM * scale->budget_ms)) { return 1; }
+    float ideal = traced_scale * sqrt(0.5 * (1 + SCALE_HEADROOM) * scale->budget_ms / ms);
+    if (ideal < SCALE_MIN) { ideal = SCALE_MIN; }
+    if (ideal > 1)         { ideal = 1; }
+    scale->target += SCALE_GAIN * (ideal - scale->target);
+    return 1;
+}
+
+/* applies the target to the traced rect for images of width x height, call only when the image starts over anyway (see draw()) */
+static void scale_update(scale_t* scale, uint width, uint height)
+{
+    while (scale_retire(scale)) {}
+
+    float s = SCALE_STEP * (int) (scale->target / SCALE_STEP + 0.5f);
+    if (s < SCALE_MIN) { s = SCALE_MIN; }
+    if (s > 1)         { s = 1; }
+    scale->scale = s;
+    scale_resize(scale, width, height);
+}
+
+/* call right before the dispatch, NOTE: the dispatch is not measured when all queries are in flight */
+static void scale_begin(scale_t* scale) { gpu_timer_begin(&scale->timer, scale->scale); }
+
+/* call right after the dispatch */
+static void scale_end(scale_t* scale)   { gpu_timer_end(&scale->timer); }
@@ -0,0 +1,398 @@
+/*
+ * Scene description shared by the compute shader renderer (main.c) and the cpu reference renderer
+ * (cpu.c), builds the scene and its bounding volume hierarchies in exactly the layout that is
+ * uploaded to the shader storage buffers (see common.h).
+ *
+ * NOTE: expects the C versions of the structs in common.h to be declared before it is included.
+ */
+#include <stdio.h>
+#include <assert.h>
+#include <string.h> // for memset, memcpy
+#include <time.h>   // for clock
+#include <math.h>   // for sqrtf, sinf, cosf, M_PI
+
+/* NOTE: teapot.obj.inc is wrapped in S() just like the shaders in main.c */
+#ifndef S
+#define _STRINGIFY(...) #__VA_ARGS__ "\n"
+#define S(...) _STRINGIFY(__VA_ARGS__)
+#endif
+
+/* NOTE: "string too big" error on msvc */
+char teapot_obj[] = ""
+#if !defined(_MSC_VER)
+                   #include "teapot.obj.inc"
+#endif
+                   ;
+
+#define TINYOBJ_LOADER_C_IMPLEMENTATION
+#include "tinyobj_loader_c.h"
+
+#include "bvh.h"
+
+/*
+ * Scene that is sized at runtime, stored per primitive type (structure of arrays) the way it is
+ * uploaded to the shader. Triangles are faces indexing into a shared vertex array and every
+ * primitive references its material by index. The trees over the faces and the spheres share one
+ * node buffer with the second and third tree starting at triangle_bvh_root and sphere_bvh_root.
+ */
+typedef struct scene_t
+{
+    vec4*       vertices;  uint vertex_count;   uint vertex_capacity;   /* w is unused */
+    face_t*     faces;     uint face_count;     uint face_capacity;
+    triangle_t* triangles; /* one per face, see scene_build_triangles() */
+    sphere_t*   spheres;   uint sphere_count;   uint sphere_capacity;
+    material_t* materials; uint material_count; uint material_capacity;
+    light_t*    lights;    uint light_count;    uint light_capacity;
+
+    bvh_node_t* nodes;     uint node_count;
+    uint        triangle_bvh_root;
+    uint        sphere_bvh_root;
+} scene_t;
+
+/* appends a zero-initialized element to one of the arrays of the scene, growing it if necessary */
+void* scene_push(void* array, uint* count, uint* capacity, size_t size)
+{
+    void** data = array;
+    if (*count == *capacity)
+    {
+        *capacity = *capacity ? 2 * *capacity : 32;
+        *data     = realloc(*data, size * *capacity);
+    }
+    void* elem = (char*) *data + size * (*count)++;
+    memset(elem, 0, size);
+    return elem;
+}
+
+uint scene_add_material(scene_t* scene, uint type, vec4 color, float spec)
+{
+    material_t* mat = scene_push(&scene->materials, &scene->material_count, &scene->material_capacity, sizeof(material_t));
+    mat->type  = type;
+    mat->color = color;
+    mat->spec  = spec;
+    return scene->material_count - 1;
+}
+
+uint scene_add_vertex(scene_t* scene, vec3 pos)
+{
+    vec4* vertex = scene_push(&scene->vertices, &scene->vertex_count, &scene->vertex_capacity, sizeof(vec4));
+    *vertex = (vec4){{{pos.x, pos.y, pos.z, 1}}};
+    return scene->vertex_count - 1;
+}
+
+void scene_add_face(scene_t* scene, uint a, uint b, uint c, uint mat)
+{
+    face_t* face = scene_push(&scene->faces, &scene->face_count, &scene->face_capacity, sizeof(face_t));
+    face->idx = (uvec3){{{a, b, c}}};
+    face->mat = mat;
+}
+
+/* NOTE: vertices are not shared with other triangles, use scene_add_vertex/face for meshes */
+void scene_add_triangle(scene_t* scene, vec3 a, vec3 b, vec3 c, uint mat)
+{
+    uint first = scene_add_vertex(scene, a);
+    scene_add_vertex(scene, b);
+    scene_add_vertex(scene, c);
+    scene_add_face(scene, first, first + 1, first + 2, mat);
+}
+
+void scene_add_sphere(scene_t* scene, vec3 pos, float radius, uint mat)
+{
+    sphere_t* sphere = scene_push(&scene->spheres, &scene->sphere_count, &scene->sphere_capacity, sizeof(sphere_t));
+    sphere->pos    = pos;
+    sphere->radius = radius;
+    sphere->mat    = mat;
+}
+
+light_t* scene_add_light(scene_t* scene)
+{
+    return scene_push(&scene->lights, &scene->light_count, &scene->light_capacity, sizeof(light_t));
+}
+
+void scene_free(scene_t* scene)
+{
+    free(scene->vertices);
+    free(scene->faces);
+    free(scene->triangles);
+    free(scene->spheres);
+    free(scene->materials);
+    free(scene->lights);
+    free(scene->nodes);
+    memset(scene, 0, sizeof(scene_t));
+}
+
+/*
+ * Appends the triangulated obj data as an indexed mesh, applying a per-axis scale followed by a
+ * translation to every vertex. usemtl materials are appended to the material table, faces
+ * without one get a default material.
+ */
+void scene_add_obj(scene_t* scene, const tinyobj_attrib_t* attrib, const tinyobj_material_t* materials,
+                   size_t num_materials, vec3 scale, vec3 offset)
+{
+    uint first_vertex   = scene->vertex_count;
+    uint first_material = scene_add_material(scene, MATERIAL_TYPE_DIFFUSE, (vec4){{{0.8, 0.8, 0.8, 1}}}, 0);
+
+    for (size_t i = 0; i < num_materials; i++)
+    {
+        const tinyobj_material_t* mat = &materials[i];
+        /* NOTE illumination models >= 3 have "reflection on" in the obj spec */
+        scene_add_material(scene, (mat->illum >= 3) ? MATERIAL_TYPE_SPECULAR : MATERIAL_TYPE_DIFFUSE,
+                           (vec4){{{mat->diffuse[0], mat->diffuse[1], mat->diffuse[2], 1}}},
+                           (mat->specular[0] + mat->specular[1] + mat->specular[2]) / 3.0f);
+    }
+
+    for (uint i = 0; i < attrib->num_vertices; i++)
+    {
+        vec3 pos;
+        for (int a = 0; a < 3; a++) { pos.e[a] = attrib->vertices[3 * i + a] * scale.e[a] + offset.e[a]; }
+        scene_add_vertex(scene, pos);
+    }
+
+    /* NOTE num_faces counts the indices, num_face_num_verts the faces */
+    for (uint i = 0; i < attrib->num_face_num_verts; i++)
+    {
+        assert(attrib->face_num_verts[i] == 3); /* TINYOBJ_FLAG_TRIANGULATE */
+        scene_add_face(scene, first_vertex + attrib->faces[3 * i + 0].v_idx,
+                              first_vertex + attrib->faces[3 * i + 1].v_idx,
+                              first_vertex + attrib->faces[3 * i + 2].v_idx,
+                              first_material + 1 + attrib->material_ids[i]); /* usemtl id, -1 if there is none */
+    }
+}
+
+#ifdef BENCH_TRIANGLE_COUNT
+/* tessellates a sphere into (at most) tri_count triangles for the scaling benchmark, see bench.sh */
+static void bench_tessellate_sphere(scene_t* scene, int tri_count, vec3 center, float radius, uint mat)
+{
+    int  stacks = (int) sqrtf(tri_count / 4.0f);
+    int  slices = 2 * stacks;
+    uint first  = scene->vertex_count;
+
+    for (int s = 0; s <= stacks; s++)
+    {
+        for (int l = 0; l <= slices; l++)
+        {
+            float theta = M_PI * s / stacks;
+            float phi   = 2 * M_PI * l / slices;
+            scene_add_vertex(scene, (vec3){{{center.x + radius * sinf(theta) * cosf(phi),
+                                             center.y + radius * cosf(theta),
+                                             center.z + radius * sinf(theta) * sinf(phi)}}});
+        }
+    }
+
+    /* two triangles for the patch between two stacks and two slices */
+    for (int s = 0; s < stacks; s++)
+    {
+        for (int l = 0; l < slices; l++)
+        {
+            uint p0 = first + s * (slices + 1) + l;
+            uint p2 = p0 + slices + 1;
+            scene_add_face(scene, p0, p0 + 1, p2 + 1, mat);
+            scene_add_face(scene, p0, p2 + 1, p2,     mat);
+        }
+    }
+}
+#endif
+
+/* precomputes the edges and normals of all faces, call once the faces are in their final (bvh) order */
+static void scene_build_triangles(scene_t* scene)
+{
+    scene->triangles = malloc(sizeof(triangle_t) * (scene->face_count ? scene->face_count : 1));
+    for (uint n = 0; n < scene->face_count; n++)
+    {
+        vec4 a = scene->vertices[scene->faces[n].idx.x];
+        vec4 b = scene->vertices[scene->faces[n].idx.y];
+        vec4 c = scene->vertices[scene->faces[n].idx.z];
+
+        triangle_t* triangle = &scene->triangles[n];
+        triangle->a  = (vec3){{{a.x, a.y, a.z}}};
+        triangle->ab = (vec3){{{b.x - a.x, b.y - a.y, b.z - a.z}}};
+        triangle->ac = (vec3){{{c.x - a.x, c.y - a.y, c.z - a.z}}};
+
+        vec3  normal = {{{triangle->ab.y * triangle->ac.z - triangle->ab.z * triangle->ac.y,
+                          triangle->ab.z * triangle->ac.x - triangle->ab.x * triangle->ac.z,
+                          triangle->ab.x * triangle->ac.y - triangle->ab.y * triangle->ac.x}}};
+        float length = sqrtf(normal.x * normal.x + normal.y * normal.y + normal.z * normal.z);
+        if (length > 0) { normal.x /= length; normal.y /= length; normal.z /= length; }
+        triangle->normal_x = normal.x;
+        triangle->normal_y = normal.y;
+        triangle->normal_z = normal.z;
+    }
+}
+
+/*
+ * builds a bvh over the faces [first, first + count) into nodes (which end up at node_base in the node buffer) and
+ * reorders those faces so that every leaf references a contiguous range, bounds holds one box per face of the
+ * scene and order is scratch space for at least count indices, returns the number of nodes used
+ */
+static uint build_face_bvh(scene_t* scene, bvh_node_t* nodes, uint node_base, uint first, uint count,
+                           const aabb_t* bounds, uint* order)
+{
+    uint node_count = bvh_build(nodes, order, bounds + first, count, node_base);
+
+    /* NOTE: the builder numbers the faces from 0, leaves have to point into the whole face buffer */
+    for (uint n = 0; n < node_count; n++) { if (nodes[n].count > 0) { nodes[n].left_first += first; } }
+
+    face_t* sorted_faces = malloc(sizeof(face_t) * (count ? count : 1));
+    for (uint n = 0; n < count; n++) { sorted_faces[n] = scene->faces[first + order[n]]; }
+    memcpy(scene->faces + first, sorted_faces, sizeof(face_t) * count);
+    free(sorted_faces);
+
+    return node_count;
+}
+
+void get_file_data(void* c, const char* f, int m, const char* o, char **buf, size_t *len) { *buf = teapot_obj; *len = sizeof(teapot_obj);}
+
+/* builds the default scene with the teapot from teapot.obj.inc, returns 0 on failure */
+int scene_load(scene_t* scene)
+{
+    /* load mesh from obj file */
+    uint mesh_face_count = 0;
+    {
+        tinyobj_attrib_t attrib;
+        tinyobj_shape_t* shapes = NULL;
+        size_t num_shapes;
+        tinyobj_material_t* materials = NULL;
+        size_t num_materials;
+        unsigned int flags = TINYOBJ_FLAG_TRIANGULATE;
+
+        int ret = tinyobj_parse_obj(&attrib, &shapes, &num_shapes, &materials,
+                                    &num_materials, "teapot.obj", get_file_data, NULL, flags);
+        if (ret != TINYOBJ_SUCCESS) {
+            printf("Failure\n");
+            return 0;
+        }
+        printf("# of shapes    = %d\n", (int)num_shapes);
+        printf("# of materials = %d\n", (int)num_materials);
+        printf("# of vertices = %d\n", attrib.num_vertices);
+        printf("# of faces    = %d\n", attrib.num_faces);
+
+        /* NOTE: the teapot is y-up, turn it upside down (our y points towards the floor) and put it onto the floor plane */
+        scene_add_obj(scene, &attrib, materials, num_materials, (vec3){{{-1, -1, 1}}}, (vec3){{{0, 5.1, -8}}});
+        mesh_face_count = scene->face_count;
+
+        tinyobj_attrib_free(&attrib);
+        tinyobj_shapes_free(shapes, num_shapes);
+        tinyobj_materials_free(materials, num_materials);
+    }
+
+    /* construct scene */
+    {
+        uint box         = scene_add_material(scene, MATERIAL_TYPE_DIFFUSE,  (vec4){{{0,0,1,1}}},           0);
+        uint yellow      = scene_add_material(scene, MATERIAL_TYPE_SPECULAR, (vec4){{{1,1,0,1}}},           0.5f);
+        uint magenta     = scene_add_material(scene, MATERIAL_TYPE_SPECULAR, (vec4){{{1,0,1,1}}},           0.9f);
+        uint back_wall   = scene_add_material(scene, MATERIAL_TYPE_DIFFUSE,  (vec4){{{0.3,0.2,1,1}}},       0);
+        uint left_wall   = scene_add_material(scene, MATERIAL_TYPE_DIFFUSE,  (vec4){{{1.0, 0.0, 0, 1}}},    0);
+        uint right_wall  = scene_add_material(scene, MATERIAL_TYPE_DIFFUSE,  (vec4){{{0.0, 1.0, 0.0, 1}}},  0);
+        uint gray        = scene_add_material(scene, MATERIAL_TYPE_DIFFUSE,  (vec4){{{0.3, 0.3, 0.3, 1}}},  0);
+        uint floor_plane = scene_add_material(scene, MATERIAL_TYPE_DIFFUSE,  (vec4){{{0.5, 0.8, 0.3, 1}}},  0);
+
+        // box front
+        scene_add_triangle(scene, (vec3){{{ 3.0, 5.0, -1}}}, (vec3){{{ 0.0, 5.0, -1}}}, (vec3){{{ 0.0, 2.0, -1}}}, box);
+        scene_add_triangle(scene, (vec3){{{ 3.0, 5.0, -1}}}, (vec3){{{ 0.0, 2.0, -1}}}, (vec3){{{ 3.0, 2.0, -1}}}, box);
+
+        // box top
+        scene_add_triangle(scene, (vec3){{{ 0.0, 2.0, -1}}}, (vec3){{{ 0.0, 2.0,  3}}}, (vec3){{{ 3.0, 2.0, -1}}}, box);
+        scene_add_triangle(scene, (vec3){{{ 0.0, 2.0,  3}}}, (vec3){{{ 3.0, 2.0,  3}}}, (vec3){{{ 3.0, 2.0, -1}}}, box);
+
+        // box right side
+        scene_add_triangle(scene, (vec3){{{ 0.0, 5.0, -1}}}, (vec3){{{ 0.0, 5.0,  3}}}, (vec3){{{ 0.0, 2.0,  3}}}, box);
+        scene_add_triangle(scene, (vec3){{{ 0.0, 2.0,  3}}}, (vec3){{{ 0.0, 2.0, -1}}}, (vec3){{{ 0.0, 5.0, -1}}}, box);
+
+        scene_add_sphere(scene, (vec3){{{  2, 0.5, -3}}}, 1.0, yellow);
+        scene_add_sphere(scene, (vec3){{{ -1,  -2,  2}}}, 1.0, magenta);
+
+        // back wall
+        scene_add_triangle(scene, (vec3){{{   5, -5, 5}}}, (vec3){{{  -5, -5, 5}}}, (vec3){{{  -5,  5, 5}}}, back_wall);
+        scene_add_triangle(scene, (vec3){{{   5,  5, 5}}}, (vec3){{{   5, -5, 5}}}, (vec3){{{  -5,  5, 5}}}, back_wall);
+
+        // left wall
+        scene_add_triangle(scene, (vec3){{{5, -5, -5}}}, (vec3){{{5,  5, -5}}}, (vec3){{{5, -5,  5}}}, left_wall);
+        scene_add_triangle(scene, (vec3){{{5,  5,  5}}}, (vec3){{{5, -5,  5}}}, (vec3){{{5,  5, -5}}}, left_wall);
+
+        // right wall
+        scene_add_triangle(scene, (vec3){{{-5, -5,  5}}}, (vec3){{{-5,  5,  5}}}, (vec3){{{-5, -5, -5}}}, right_wall);
+        scene_add_triangle(scene, (vec3){{{-5,  5,  5}}}, (vec3){{{-5,  5, -5}}}, (vec3){{{-5, -5, -5}}}, right_wall);
+
+        // ceiling
+        scene_add_triangle(scene, (vec3){{{-5, -5, -5}}}, (vec3){{{ 5, -5, -5}}}, (vec3){{{-5, -5,  5}}}, gray);
+        scene_add_triangle(scene, (vec3){{{ 5, -5,  5}}}, (vec3){{{-5, -5,  5}}}, (vec3){{{ 5, -5, -5}}}, gray);
+
+        // floor
+        scene_add_triangle(scene, (vec3){{{-5,  5, -5}}}, (vec3){{{ 5,  5, -5}}}, (vec3){{{-5,  5,  5}}}, gray);
+        scene_add_triangle(scene, (vec3){{{ 5,  5,  5}}}, (vec3){{{-5,  5,  5}}}, (vec3){{{ 5,  5, -5}}}, gray);
+
+        // "infinite" floor plane
+        scene_add_triangle(scene, (vec3){{{-5000,  5.1, -5000}}}, (vec3){{{ 5000,  5.1, -5000}}}, (vec3){{{-5000,  5.1,  5000}}}, floor_plane);
+        scene_add_triangle(scene, (vec3){{{ 5000,  5.1,  5000}}}, (vec3){{{-5000,  5.1,  5000}}}, (vec3){{{ 5000,  5.1, -5000}}}, floor_plane);
+
+        #ifdef BENCH_TRIANGLE_COUNT
+        uint bench = scene_add_material(scene, MATERIAL_TYPE_DIFFUSE, (vec4){{{0.8, 0.8, 0.8, 1}}}, 0);
+        bench_tessellate_sphere(scene, BENCH_TRIANGLE_COUNT, (vec3){{{-1.5, 0.5, -3}}}, 1.2f, bench);
+        #endif
+    }
+
+    /* build bounding volume hierarchies over the mesh faces, over the remaining faces and over the spheres
+     *
+     * NOTE: the mesh gets its own tree so its nodes stay tight, mixing it with the huge floor triangles makes
+     * every ray walk down to the teapot (twice as many node visits) */
+    {
+        clock_t start  = clock();
+        uint    count  = (scene->face_count > scene->sphere_count) ? scene->face_count : scene->sphere_count;
+        aabb_t* bounds = malloc(sizeof(aabb_t) * count);
+        uint*   order  = malloc(sizeof(uint) * count);
+
+        scene->nodes = malloc(sizeof(bvh_node_t) * (2 * scene->face_count + 2 * scene->sphere_count + 3));
+
+        for (uint n = 0; n < scene->face_count; n++)
+        {
+            bounds[n] = aabb_empty();
+            for (int v = 0; v < 3; v++)
+            {
+                vec4 p = scene->vertices[scene->faces[n].idx.e[v]];
+                aabb_grow(&bounds[n], (vec3){{{p.x, p.y, p.z}}});
+            }
+        }
+
+        scene->node_count         = build_face_bvh(scene, scene->nodes, 0, 0, mesh_face_count, bounds, order);
+        scene->triangle_bvh_root  = scene->node_count;
+        scene->node_count        += build_face_bvh(scene, scene->nodes + scene->triangle_bvh_root, scene->triangle_bvh_root,
+                                                   mesh_face_count, scene->face_count - mesh_face_count, bounds, order);
+
+        for (uint n = 0; n < scene->sphere_count; n++)
+        {
+            sphere_t* sphere = &scene->spheres[n];
+            for (int a = 0; a < 3; a++)
+            {
+                bounds[n].min.e[a] = sphere->pos.e[a] - sphere->radius;
+                bounds[n].max.e[a] = sphere->pos.e[a] + sphere->radius;
+            }
+        }
+
+        scene->sphere_bvh_root  = scene->node_count;
+        scene->node_count      += bvh_build(scene->nodes + scene->sphere_bvh_root, order, bounds, scene->sphere_count,
+                                            scene->sphere_bvh_root);
+
+        sphere_t* sorted_spheres = malloc(sizeof(sphere_t) * scene->sphere_capacity);
+        for (uint n = 0; n < scene->sphere_count; n++) { sorted_spheres[n] = scene->spheres[order[n]]; }
+        free(scene->spheres);
+        scene->spheres = sorted_spheres;
+
+        free(order);
+        free(bounds);
+
+        printf("Built bvh with %u nodes over %u faces and %u spheres in %.1f ms\n", scene->node_count, scene->face_count,
+               scene->sphere_count, 1000.0 * (clock() - start) / CLOCKS_PER_SEC);
+    }
+
+    scene_build_triangles(scene);
+
+    {
+        light_t* light = scene_add_light(scene);
+        light->type           = LIGHT_TYPE_POINT;
+        light->p.intensity    = 0.40f;
+        light->pos            = (vec3){{{0.8, -4.9, -3}}}; // above sphere
+        //light->pos            = (vec3){{{2.5, -4.9, 2.5}}};
+        light->color          = (vec4){{{1,1,0.7,1}}};
+    }
+
+    return 1;
+}
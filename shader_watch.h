@@ -0,0 +1,107 @@
+/*
+ * Shader-only hot reload (main --watch-shader).
+ *
+ * Watches compute.glsl with inotify, and draw() recompiles only the compute programs once it is
+ * written (see reload_shader() in main.c), the scene, the buffers and the textures stay as they
+ * are. compute.glsl is c code that builds the source as a string, so it is run through the c
+ * preprocessor with the options the dll was built with, and the string literals of the output
+ * are joined into the source. That is the same text as the one built into the dll as long as
+ * the file did not change, so the program caches still hit.
+ *
+ * NOTE: common.h also declares the structs of the c code, a change there still needs a rebuild
+ * of the dll (see dev.sh). Only on linux, elsewhere --watch-shader does nothing.
+ */
+#include <stdlib.h> // for malloc, realloc, free
+
+#define SHADER_PATH          "compute.glsl"
+#define SHADER_PREPROCESSOR  "cc -E -P -x c" // NOTE: prints the source as c string literals
+
+typedef struct shader_watch_t
+{
+    int active;
+    int fd;    /* inotify instance, non-blocking */
+} shader_watch_t;
+
+#if defined(__linux__)
+#include <sys/inotify.h>
+#include <unistd.h> // for read, close
+
+static void shader_watch_start(shader_watch_t* watch)
+{
+    memset(watch, 0, sizeof(shader_watch_t));
+    watch->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (watch->fd < 0) { printf("Could not watch %s\n", SHADER_PATH); return; }
+
+    /* NOTE: the directory, editors often write a new file and rename it over the old one */
+    if (inotify_add_watch(watch->fd, ".", IN_CLOSE_WRITE | IN_MOVED_TO) < 0) { printf("Could not watch %s\n", SHADER_PATH); close(watch->fd); return; }
+    watch->active = 1;
+}
+
+/* returns 1 if compute.glsl was written since the last call, never blocks */
+static int shader_watch_changed(shader_watch_t* watch)
+{
+    if (!watch->active) { return 0; }
+
+    int  changed = 0;
+    char events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    for (ssize_t length; (length = read(watch->fd, events, sizeof(events))) > 0; )
+    {
+        for (char* event = events; event < events + length; event += sizeof(struct inotify_event) + ((struct inotify_event*) event)->len)
+        {
+            const struct inotify_event* e = (const struct inotify_event*) event;
+            if (e->len > 0 && strcmp(e->name, SHADER_PATH) == 0) { changed = 1; }
+        }
+    }
+    return changed;
+}
+
+/*
+ * Runs compute.glsl through the c preprocessor with options (-D...) and returns the source
+ * (malloc'd), or NULL if that fails or the output is not only string literals.
+ */
+static char* shader_watch_load(const char* options)
+{
+    char command[1024];
+    snprintf(command, sizeof(command), SHADER_PREPROCESSOR " %s %s", options, SHADER_PATH);
+    FILE* pipe = popen(command, "r");
+    if (!pipe) { printf("Could not run %s\n", command); return NULL; }
+
+    size_t length = 0, capacity = 1 << 16;
+    char*  output = malloc(capacity);
+    for (size_t n; output && (n = fread(output + length, 1, capacity - length - 1, pipe)) > 0; )
+    {
+        length += n;
+        if (length + 1 == capacity) { capacity *= 2; output = realloc(output, capacity); }
+    }
+    int status = pclose(pipe);
+    if (!output || status != 0) { printf("Preprocessing %s failed\n", SHADER_PATH); free(output); return NULL; }
+    output[length] = 0;
+
+    /* NOTE: joins the literals in place, the source is never longer than the output */
+    char* source = output;
+    for (const char* c = output; *c; c++)
+    {
+        if (*c == ' ' || *c == '\n' || *c == '\t') { continue; }
+        if (*c != '"') { printf("Preprocessing %s left more than string literals\n", SHADER_PATH); free(output); return NULL; }
+
+        for (c++; *c && *c != '"'; c++)
+        {
+            if (*c != '\\' || !c[1]) { *source++ = *c; continue; }
+            c++;
+            switch (*c)
+            {
+                case 'n': { *source++ = '\n'; } break;
+                case 't': { *source++ = '\t'; } break;
+                default:  { *source++ = *c;   } break; /* \" \\ \' */
+            }
+        }
+        if (!*c) { break; }
+    }
+    *source = 0;
+    return output;
+}
+#else
+static void  shader_watch_start(shader_watch_t* watch)    { memset(watch, 0, sizeof(shader_watch_t)); printf("--watch-shader is only supported on linux\n"); }
+static int   shader_watch_changed(shader_watch_t* watch)  { return 0; }
+static char* shader_watch_load(const char* options)       { return NULL; }
+#endif
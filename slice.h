@@ -0,0 +1,128 @@
+/*
+ * Time slicing (main --time-slice 8).
+ *
+ * Splits the image into slices of the tile list of compact() (see compact_tiles() in main.c) and
+ * dispatches only as many tiles per draw() as fit into a gpu time budget, so input handling and
+ * the blit keep going while an expensive image is traced. The next draw() resumes with the next
+ * slice, the tiles that are not traced yet show the previous image in the meantime. A camera
+ * that moves starts a new image right away. The time per tile is measured with timer.h without
+ * waiting for it.
+ *
+ * The length of the tile list is only known to the gpu. It is copied into a buffer of its own
+ * and read back once the fence behind the copy is signaled (as in progressive.h), until then
+ * the slices go over all tiles of the traced rect. The shader skips the entries past the end of
+ * the list (see tile_pixel() in compute.glsl), so those slices only cost empty work groups.
+ *
+ * NOTE: expects the gl functions (glew) to be declared.
+ */
+
+#define SLICE_FIRST_TILES   32  // tiles of the first slice, before there is a measurement
+#define SLICE_GROWTH         2  // a slice has at most this many times the tiles of the one before, cheap tiles (sky) are followed by expensive ones
+
+typedef struct slice_t
+{
+    int          active;
+    float        budget_ms;
+    float        tile_ms;  /* estimated gpu time of one tile, 0 until measured */
+    uint         offset;   /* first entry of the tile list of the next slice */
+    uint         count;    /* entries in the tile list of the image in progress (at most, until read back), offset == count when it is done */
+    uint         tiles;    /* of the slice being dispatched, or the last one */
+    camera_t     camera;   /* of the image in progress */
+    gpu_timer_t  timer;    /* of the slices, tagged with their tiles */
+
+    unsigned int count_buffer; /* length of the tile list, copied from the queue of SSBO_TILES */
+    GLsync       count_fence;  /* after the copy, 0 once count is read back */
+} slice_t;
+
+static void slice_start(slice_t* slice, float budget_ms)
+{
+    memset(slice, 0, sizeof(slice_t));
+    slice->active    = 1;
+    slice->budget_ms = budget_ms;
+    gpu_timer_start(&slice->timer);
+
+    glGenBuffers(1, &slice->count_buffer);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, slice->count_buffer);
+    glBufferData(GL_COPY_WRITE_BUFFER, sizeof(uint), NULL, GL_STREAM_READ);
+}
+
+/* drops the image in progress, call when the images or the programs change */
+static void slice_reset(slice_t* slice)
+{
+    slice->offset = 0;
+    slice->count  = 0;
+    if (slice->count_fence) { glDeleteSync(slice->count_fence); slice->count_fence = 0; }
+}
+
+/* reads back the length of the tile list once the gpu got through compact, never waits */
+static void slice_read_count(slice_t* slice)
+{
+    if (!slice->count_fence) { return; }
+    GLenum status = glClientWaitSync(slice->count_fence, 0, 0);
+    if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) { return; }
+    glDeleteSync(slice->count_fence);
+    slice->count_fence = 0;
+
+    uint count = 0;
+    glBindBuffer(GL_COPY_READ_BUFFER, slice->count_buffer);
+    glGetBufferSubData(GL_COPY_READ_BUFFER, 0, sizeof(uint), &count);
+    if (count < slice->count) { slice->count = count; }
+}
+
+/* returns 1 while an image is in progress and was traced with camera */
+static int slice_pending(const slice_t* slice, const camera_t* camera)
+{
+    return slice->active && slice->offset < slice->count && memcmp(camera, &slice->camera, sizeof(camera_t)) == 0;
+}
+
+/* reads back the oldest query if it is available and updates the time per tile */
+static int slice_retire(slice_t* slice)
+{
+    double ms, tiles;
+    if (!gpu_timer_retire(&slice->timer, 0, &ms, &tiles)) { return 0; }
+
+    /* NOTE: only the latest slice counts, the next one is traced right after it and is about as expensive */
+    slice->tile_ms = ms / tiles;
+    return 1;
+}
+
+/*
+ * call once the tile list of a new image is built into tile_buffer (a queue_t and the tiles),
+ * max_count is the length it has at most
+ */
+static void slice_image(slice_t* slice, const camera_t* camera, unsigned int tile_buffer, uint max_count)
+{
+    slice_reset(slice);
+    slice->count  = max_count;
+    slice->camera = *camera;
+
+    glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+    glBindBuffer(GL_COPY_READ_BUFFER, tile_buffer);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, slice->count_buffer);
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, offsetof(queue_t, count), 0, sizeof(uint));
+    slice->count_fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+/* picks the tiles of the next slice and starts measuring it, call right before the dispatch */
+static void slice_begin(slice_t* slice)
+{
+    while (slice_retire(slice)) {}
+    slice_read_count(slice);
+
+    uint tiles = (slice->tile_ms > 0) ? (uint) (slice->budget_ms / slice->tile_ms) : SLICE_FIRST_TILES;
+    if (slice->tiles > 0 && tiles > SLICE_GROWTH * slice->tiles) { tiles = SLICE_GROWTH * slice->tiles; }
+    if (tiles < 1)                             { tiles = 1; }
+    if (tiles > QUEUE_GROUPS_X_MAX)            { tiles = QUEUE_GROUPS_X_MAX; }
+    if (tiles > slice->count - slice->offset)  { tiles = slice->count - slice->offset; }
+    slice->tiles = tiles;
+    if (tiles > 0) { gpu_timer_begin(&slice->timer, tiles); }
+}
+
+/* call right after the dispatch, returns 1 once the image is done */
+static int slice_end(slice_t* slice)
+{
+    slice->offset += slice->tiles;
+    gpu_timer_end(&slice->timer);
+    slice_read_count(slice);
+    return slice->offset >= slice->count;
+}
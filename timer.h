@@ -0,0 +1,83 @@
+/*
+ * Gpu time of a piece of work without waiting for it (used by bench.h, scale.h and slice.h).
+ *
+ * A pair of GL_TIMESTAMP queries goes around the work (the same interval a GL_TIME_ELAPSED query
+ * covers, which mesa's llvmpipe reports as 0 for compute dispatches). The pairs go into a small
+ * ring and are read back once their result is available, the caller keeps a tag with every pair
+ * (a frame number, the scale or the tiles the work was done with).
+ *
+ * NOTE: expects the gl functions (glew) to be declared.
+ */
+
+#define TIMER_QUERY_COUNT  4 // intervals that can be in flight, work past that is not measured unless the caller waits
+
+typedef struct gpu_timer_t
+{
+    /* query pairs (before and after the work), first is the oldest one in flight */
+    unsigned int query[TIMER_QUERY_COUNT][2];
+    double       tag[TIMER_QUERY_COUNT];
+    uint         first;
+    uint         count;
+    int          measuring; /* between gpu_timer_begin() and gpu_timer_end() of an interval with a query */
+} gpu_timer_t;
+
+static void gpu_timer_start(gpu_timer_t* timer)
+{
+    memset(timer, 0, sizeof(gpu_timer_t));
+    glGenQueries(2 * TIMER_QUERY_COUNT, &timer->query[0][0]);
+}
+
+static void gpu_timer_stop(gpu_timer_t* timer)
+{
+    glDeleteQueries(2 * TIMER_QUERY_COUNT, &timer->query[0][0]);
+    memset(timer, 0, sizeof(gpu_timer_t));
+}
+
+/*
+ * reads back the oldest interval, returns 1 with its time in ms and its tag or 0 if there is none
+ * or it is not available yet, wait blocks until the gpu is done with the work
+ */
+static int gpu_timer_retire(gpu_timer_t* timer, int wait, double* ms, double* tag)
+{
+    if (timer->count == 0) { return 0; }
+
+    uint n = timer->first;
+    if (!wait)
+    {
+        unsigned int available = 0;
+        glGetQueryObjectuiv(timer->query[n][1], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available) { return 0; }
+    }
+    GLuint64 start = 0, end = 0; /* in ns */
+    glGetQueryObjectui64v(timer->query[n][0], GL_QUERY_RESULT, &start);
+    glGetQueryObjectui64v(timer->query[n][1], GL_QUERY_RESULT, &end);
+    *ms  = (end - start) / 1e6;
+    *tag = timer->tag[n];
+
+    timer->first = (timer->first + 1) % TIMER_QUERY_COUNT;
+    timer->count--;
+    return 1;
+}
+
+/* call right before the work, returns 0 if all queries are in flight and the work is not measured */
+static int gpu_timer_begin(gpu_timer_t* timer, double tag)
+{
+    timer->measuring = (timer->count < TIMER_QUERY_COUNT);
+    if (!timer->measuring) { return 0; }
+
+    uint n = (timer->first + timer->count) % TIMER_QUERY_COUNT;
+    timer->tag[n] = tag;
+    glQueryCounter(timer->query[n][0], GL_TIMESTAMP);
+    return 1;
+}
+
+/* call right after the work */
+static void gpu_timer_end(gpu_timer_t* timer)
+{
+    if (!timer->measuring) { return; }
+
+    uint n = (timer->first + timer->count) % TIMER_QUERY_COUNT;
+    glQueryCounter(timer->query[n][1], GL_TIMESTAMP);
+    timer->count++;
+    timer->measuring = 0;
+}